@@ -0,0 +1,377 @@
+/* sforth - tdwsl 2022 */
+
+/* the array words, over n cells of data space starting at byte addresses
+ * that need not be aligned. The arithmetic ones have an AVX2 loop, used
+ * when the CPU has it, that takes eight cells at a time and leaves the
+ * rest to the plain loop it otherwise runs from the start. Arithmetic
+ * wraps in both alike. Then sorting, searching and hash tables, which
+ * are kept in data space too. Part of runtime.h, so programs from
+ * --emit-c get them as well */
+
+#ifndef FORTH_ARRAY_H
+#define FORTH_ARRAY_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FORTH_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+static inline bool forth_hasAvx2() {
+#ifdef FORTH_AVX2
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+static inline int forth_cellAt(const unsigned char *p, int i) {
+  int n;
+  memcpy(&n, p + (long)i*sizeof(int), sizeof(int));
+  return n;
+}
+
+static inline void forth_setCellAt(unsigned char *p, int i, int n) {
+  memcpy(p + (long)i*sizeof(int), &n, sizeof(int));
+}
+
+/* the plain loops, from cell i on */
+
+static inline unsigned forth_sumFrom(const unsigned char *p, int i, int n,
+    unsigned sum)
+{
+  for(; i < n; i++)
+    sum += forth_cellAt(p, i);
+  return sum;
+}
+
+static inline unsigned forth_dotFrom(const unsigned char *a,
+    const unsigned char *b, int i, int n, unsigned sum)
+{
+  for(; i < n; i++)
+    sum += (unsigned)forth_cellAt(a, i) * forth_cellAt(b, i);
+  return sum;
+}
+
+static inline void forth_mapFrom(const unsigned char *a,
+    const unsigned char *b, unsigned char *dest, int i, int n, bool mul)
+{
+  for(; i < n; i++) {
+    unsigned x = forth_cellAt(a, i), y = forth_cellAt(b, i);
+    forth_setCellAt(dest, i, mul ? x*y : x+y);
+  }
+}
+
+static inline int forth_extremeFrom(const unsigned char *p, int i, int n,
+    bool max, int m)
+{
+  for(; i < n; i++) {
+    int x = forth_cellAt(p, i);
+    if(max ? x > m : x < m)
+      m = x;
+  }
+  return m;
+}
+
+static inline int forth_countFrom(const unsigned char *p, int i, int n,
+    int x, int count)
+{
+  for(; i < n; i++)
+    count += forth_cellAt(p, i) == x;
+  return count;
+}
+
+/* the AVX2 loops, returning how far they got in i */
+
+#ifdef FORTH_AVX2
+#define FORTH_LOAD(p, i) \
+  _mm256_loadu_si256((const __m256i*)((p) + (long)(i)*4))
+
+FORTH_AVX2 static inline unsigned forth_lanes(__m256i v) {
+  __m128i x = _mm_add_epi32(_mm256_castsi256_si128(v),
+      _mm256_extracti128_si256(v, 1));
+  x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0x4e));
+  x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0xb1));
+  return _mm_cvtsi128_si32(x);
+}
+
+FORTH_AVX2 static inline unsigned forth_sumAvx2(const unsigned char *p,
+    int *i, int n)
+{
+  __m256i sum = _mm256_setzero_si256();
+  for(; *i+8 <= n; *i += 8)
+    sum = _mm256_add_epi32(sum, FORTH_LOAD(p, *i));
+  return forth_lanes(sum);
+}
+
+FORTH_AVX2 static inline unsigned forth_dotAvx2(const unsigned char *a,
+    const unsigned char *b, int *i, int n)
+{
+  __m256i sum = _mm256_setzero_si256();
+  for(; *i+8 <= n; *i += 8)
+    sum = _mm256_add_epi32(sum,
+        _mm256_mullo_epi32(FORTH_LOAD(a, *i), FORTH_LOAD(b, *i)));
+  return forth_lanes(sum);
+}
+
+FORTH_AVX2 static inline void forth_mapAvx2(const unsigned char *a,
+    const unsigned char *b, unsigned char *dest, int *i, int n, bool mul)
+{
+  for(; *i+8 <= n; *i += 8) {
+    __m256i x = FORTH_LOAD(a, *i), y = FORTH_LOAD(b, *i);
+    x = mul ? _mm256_mullo_epi32(x, y) : _mm256_add_epi32(x, y);
+    _mm256_storeu_si256((__m256i*)(dest + (long)*i*4), x);
+  }
+}
+
+FORTH_AVX2 static inline int forth_extremeAvx2(const unsigned char *p,
+    int *i, int n, bool max, int m)
+{
+  __m256i e = _mm256_set1_epi32(m);
+  for(; *i+8 <= n; *i += 8)
+    e = max ? _mm256_max_epi32(e, FORTH_LOAD(p, *i))
+      : _mm256_min_epi32(e, FORTH_LOAD(p, *i));
+  int lanes[8];
+  _mm256_storeu_si256((__m256i*)lanes, e);
+  return forth_extremeFrom((const unsigned char*)lanes, 0, 8, max, m);
+}
+
+FORTH_AVX2 static inline int forth_countAvx2(const unsigned char *p,
+    int *i, int n, int x)
+{
+  /* equal lanes compare to -1, so subtracting counts them */
+  __m256i count = _mm256_setzero_si256(), v = _mm256_set1_epi32(x);
+  for(; *i+8 <= n; *i += 8)
+    count = _mm256_sub_epi32(count,
+        _mm256_cmpeq_epi32(FORTH_LOAD(p, *i), v));
+  return forth_lanes(count);
+}
+
+#undef FORTH_LOAD
+#endif
+
+/* SUM ( addr n -- sum ) */
+static inline int forth_sum(ForthInstance *fth, int addr, int n) {
+  const unsigned char *p = fth->memory + addr;
+  unsigned sum = 0;
+  int i = 0;
+#ifdef FORTH_AVX2
+  if(forth_hasAvx2())
+    sum = forth_sumAvx2(p, &i, n);
+#endif
+  return forth_sumFrom(p, i, n, sum);
+}
+
+/* DOT ( addr addr n -- sum ) */
+static inline int forth_dot(ForthInstance *fth, int a, int b, int n) {
+  unsigned sum = 0;
+  int i = 0;
+#ifdef FORTH_AVX2
+  if(forth_hasAvx2())
+    sum = forth_dotAvx2(fth->memory + a, fth->memory + b, &i, n);
+#endif
+  return forth_dotFrom(fth->memory + a, fth->memory + b, i, n, sum);
+}
+
+/* V+ and V* ( addr addr dest n -- ), dest may be either source */
+static inline void forth_map(ForthInstance *fth, int a, int b, int dest,
+    int n, bool mul)
+{
+  int i = 0;
+#ifdef FORTH_AVX2
+  if(forth_hasAvx2())
+    forth_mapAvx2(fth->memory + a, fth->memory + b, fth->memory + dest,
+        &i, n, mul);
+#endif
+  forth_mapFrom(fth->memory + a, fth->memory + b, fth->memory + dest,
+      i, n, mul);
+}
+
+/* VMIN and VMAX ( addr n -- n ), INT_MAX and INT_MIN of no cells */
+static inline int forth_extreme(ForthInstance *fth, int addr, int n,
+    bool max)
+{
+  const unsigned char *p = fth->memory + addr;
+  int m = max ? INT_MIN : INT_MAX;
+  int i = 0;
+#ifdef FORTH_AVX2
+  if(forth_hasAvx2())
+    m = forth_extremeAvx2(p, &i, n, max, m);
+#endif
+  return forth_extremeFrom(p, i, n, max, m);
+}
+
+/* COUNT-EQUAL ( addr n x -- count ) */
+static inline int forth_countEqual(ForthInstance *fth, int addr, int n,
+    int x)
+{
+  const unsigned char *p = fth->memory + addr;
+  int count = 0;
+  int i = 0;
+#ifdef FORTH_AVX2
+  if(forth_hasAvx2())
+    count = forth_countAvx2(p, &i, n, x);
+#endif
+  return forth_countFrom(p, i, n, x, count);
+}
+
+static inline void forth_insertionSort(unsigned char *p, int n) {
+  for(int i = 1; i < n; i++) {
+    int x = forth_cellAt(p, i), j = i;
+    for(; j > 0 && forth_cellAt(p, j-1) > x; j--)
+      forth_setCellAt(p, j, forth_cellAt(p, j-1));
+    forth_setCellAt(p, j, x);
+  }
+}
+
+/* SORT ( addr n -- ), ascending. A radix sort a byte at a time from the
+ * least significant, with the sign bit flipped so negatives come first.
+ * A pass where every cell has the same byte is skipped, so small values
+ * only take one or two. Short runs go to insertion sort */
+static inline void forth_sort(ForthInstance *fth, int addr, int n) {
+  unsigned char *p = fth->memory + addr;
+  unsigned *buf = n >= 64 ? malloc(sizeof(unsigned)*n*2) : 0;
+  if(!buf) {
+    forth_insertionSort(p, n);
+    return;
+  }
+
+  unsigned *a = buf, *b = buf + n;
+  for(int i = 0; i < n; i++)
+    a[i] = forth_cellAt(p, i) ^ 0x80000000u;
+  for(int shift = 0; shift < 32; shift += 8) {
+    int start[257] = { 0 };
+    for(int i = 0; i < n; i++)
+      start[(a[i] >> shift & 255) + 1]++;
+    if(start[(a[0] >> shift & 255) + 1] == n)
+      continue;
+    for(int d = 0; d < 256; d++)
+      start[d+1] += start[d];
+    for(int i = 0; i < n; i++)
+      b[start[a[i] >> shift & 255]++] = a[i];
+    unsigned *t = a;
+    a = b;
+    b = t;
+  }
+  for(int i = 0; i < n; i++)
+    forth_setCellAt(p, i, a[i] ^ 0x80000000u);
+  free(buf);
+}
+
+/* BSEARCH ( addr n x -- index ), of the first cell equal to x in sorted
+ * cells, -1 if there is none */
+static inline int forth_bsearch(ForthInstance *fth, int addr, int n, int x) {
+  const unsigned char *p = fth->memory + addr;
+  int lo = 0, hi = n;
+  while(lo < hi) {
+    int mid = lo + (hi-lo)/2;
+    if(forth_cellAt(p, mid) < x)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo < n && forth_cellAt(p, lo) == x ? lo : -1;
+}
+
+/* a hash table is a cell holding its number of slots, a power of two, a
+ * cell counting the keys in it and then the slots, three cells each: 1
+ * if in use, the key and the value. Keys are found by linear probing,
+ * and one slot is always left free so that probing ends */
+
+#define FORTH_TABLE_SLOT (3*(int)sizeof(int))
+#define FORTH_TABLE_MAX (1 << 24)
+
+static inline int forth_tableSlots(int n) {
+  int slots = 2;
+  if(n > FORTH_TABLE_MAX)
+    n = FORTH_TABLE_MAX;
+  while(slots < 2*n)
+    slots *= 2;
+  return slots;
+}
+
+/* bytes of data space a table for n keys takes */
+static inline int forth_tableBytes(int n) {
+  return 2*sizeof(int) + forth_tableSlots(n)*FORTH_TABLE_SLOT;
+}
+
+static inline void forth_tableInit(ForthInstance *fth, int addr, int n) {
+  int slots = forth_tableSlots(n);
+  forth_setCellAt(fth->memory + addr, 0, slots);
+  forth_setCellAt(fth->memory + addr, 1, 0);
+  memset(fth->memory + addr + 2*sizeof(int), 0, slots*FORTH_TABLE_SLOT);
+}
+
+/* TABLE-NEW ( n -- addr ) where data space is all there already, as in
+ * programs from --emit-c */
+static inline int forth_tableAllot(ForthInstance *fth, int n) {
+  int addr = fth->here;
+  fth->here += forth_tableBytes(n);
+  forth_tableInit(fth, addr, n);
+  return addr;
+}
+
+/* address of the slot holding key, or of the free one it would go in.
+ * -1 if addr does not hold a table, or if every slot holds another key,
+ * which only overwritten cells leave and which stops an insert */
+static inline int forth_tableSlot(ForthInstance *fth, int addr, int key,
+    bool insert)
+{
+  long header = 2*(long)sizeof(int);
+  int slots = addr >= 0 && addr + header <= fth->memory_size
+    ? forth_fetch(fth, addr) : 0;
+  if(slots < 2 || slots & (slots-1)
+      || addr + header + (long)slots*FORTH_TABLE_SLOT > fth->memory_size) {
+    forth_putString(fth, "not a table !\n");
+    return -1;
+  }
+
+  unsigned h = key;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  for(int i = 0; i < slots; i++, h++) {
+    int slot = addr + 2*sizeof(int) + (h & (slots-1))*FORTH_TABLE_SLOT;
+    if(!forth_fetch(fth, slot) || forth_fetch(fth, slot + sizeof(int)) == key)
+      return slot;
+  }
+  if(insert)
+    forth_putString(fth, "table full !\n");
+  return -1;
+}
+
+/* TABLE-PUT ( value key addr -- ) */
+static inline void forth_tablePut(ForthInstance *fth, int addr, int key,
+    int value)
+{
+  int slot = forth_tableSlot(fth, addr, key, true);
+  if(slot == -1)
+    return;
+  if(!forth_fetch(fth, slot)) {
+    int count = forth_fetch(fth, addr + sizeof(int));
+    if(count+1 >= forth_fetch(fth, addr)) {
+      forth_putString(fth, "table full !\n");
+      return;
+    }
+    forth_store(fth, addr + sizeof(int), count+1);
+    forth_store(fth, slot, 1);
+    forth_store(fth, slot + sizeof(int), key);
+  }
+  forth_store(fth, slot + 2*sizeof(int), value);
+}
+
+/* for TABLE-GET ( key addr -- value flag ), the address of the value
+ * stored for key, -1 if it has none */
+static inline int forth_tableFind(ForthInstance *fth, int addr, int key) {
+  int slot = forth_tableSlot(fth, addr, key, false);
+  if(slot == -1 || !forth_fetch(fth, slot))
+    return -1;
+  return slot + 2*sizeof(int);
+}
+
+#endif
@@ -0,0 +1,193 @@
+/* sforth - tdwsl 2022 */
+
+/* batches. forth_runJobs runs the source of every job on an instance
+ * attached to one frozen dictionary, spread over a pool of threads that
+ * keep an instance each. Each worker starts with an even share of the
+ * jobs and takes them from the front of it; one that runs dry steals the
+ * back half of the largest share left, so a few slow jobs do not hold up
+ * the rest. Output is collected per job and so comes back in input order */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "forth.h"
+
+typedef struct forthWorker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  /* jobs not yet taken from this worker's share */
+  int next, end;
+  struct forthPool *pool;
+} ForthWorker;
+
+typedef struct forthPool {
+  ForthDict *dict;
+  const ForthSizes *sizes;
+  bool jit;
+  ForthJob *jobs;
+  ForthWorker *workers;
+  int num_workers;
+} ForthPool;
+
+static void forth_jobOutput(void *data, const char *s, int n) {
+  ForthJob *job = data;
+  job->output = realloc(job->output, job->output_size + n + 1);
+  memcpy(job->output + job->output_size, s, n);
+  job->output_size += n;
+  job->output[job->output_size] = 0;
+}
+
+/* moves the back half of the largest share to w, false once none is left.
+ * A share emptied by a steal still in progress is run by the thief */
+static bool forth_stealJobs(ForthPool *p, ForthWorker *w) {
+  for(;;) {
+    ForthWorker *victim = 0;
+    int most = 0;
+    for(int i = 0; i < p->num_workers; i++) {
+      ForthWorker *v = &p->workers[i];
+      pthread_mutex_lock(&v->lock);
+      if(v->end - v->next > most) {
+        most = v->end - v->next;
+        victim = v;
+      }
+      pthread_mutex_unlock(&v->lock);
+    }
+    if(!victim)
+      return false;
+
+    pthread_mutex_lock(&victim->lock);
+    int n = (victim->end - victim->next + 1) / 2;
+    victim->end -= n;
+    int start = victim->end;
+    pthread_mutex_unlock(&victim->lock);
+    if(n <= 0)
+      continue;
+
+    pthread_mutex_lock(&w->lock);
+    w->next = start;
+    w->end = start + n;
+    pthread_mutex_unlock(&w->lock);
+    return true;
+  }
+}
+
+/* index of the next job for w, -1 when every job is taken */
+static int forth_takeJob(ForthPool *p, ForthWorker *w) {
+  for(;;) {
+    pthread_mutex_lock(&w->lock);
+    int job = w->next < w->end ? w->next++ : -1;
+    pthread_mutex_unlock(&w->lock);
+    if(job != -1 || !forth_stealJobs(p, w))
+      return job;
+  }
+}
+
+/* puts an instance whose job left the dictionary alone back the way
+ * forth_attachInstance made it. Whole pages past the dictionary's data
+ * are dropped rather than cleared, so they cost nothing until touched */
+static void forth_resetInstance(ForthInstance *fth) {
+  ForthDict *d = fth->frozen;
+  long page = sysconf(_SC_PAGESIZE);
+  long clear = (d->here + page-1) / page * page;
+  if(clear > fth->memory_size)
+    clear = fth->memory_size;
+
+  fth->sp = 0;
+  fth->lsp = 0;
+  fth->rsp = 0;
+  fth->quit = false;
+  memcpy(fth->memory, d->memory, d->here);
+  memset(fth->memory + d->here, 0, clear - d->here);
+  if(clear < fth->memory_size)
+    madvise(fth->memory + clear, fth->memory_size - clear, MADV_DONTNEED);
+  fth->here = d->here;
+  fth->inline_size = d->inline_size;
+  fth->stale_inlines = d->stale_inlines;
+  forth_freeProfile(fth);
+  forth_freeTasks(fth);
+}
+
+static void *forth_worker(void *data) {
+  ForthWorker *w = data;
+  ForthPool *p = w->pool;
+  ForthInstance *fth = 0;
+  int memory_size = 0;
+
+  for(int i; (i = forth_takeJob(p, w)) != -1;) {
+    /* a job that stored a word of its own, grew data space or opened a
+     * block file leaves more behind than can be reset, so the next gets
+     * a new instance */
+    if(fth && !fth->arena && fth->block.fd == -1
+        && fth->memory_size == memory_size)
+      forth_resetInstance(fth);
+    else {
+      if(fth)
+        forth_freeInstance(fth);
+      fth = forth_attachInstance(p->dict, p->sizes);
+      if(!fth) {
+        p->jobs[i].output = strdup("failed to make an instance !\n");
+        p->jobs[i].output_size = strlen(p->jobs[i].output);
+        continue;
+      }
+      memory_size = fth->memory_size;
+      if(p->jit)
+        forth_setJit(fth, true);
+    }
+
+    ForthJob *job = &p->jobs[i];
+    char *text = strdup(job->input);
+    forth_setOutput(fth, forth_jobOutput, job);
+    forth_runString(fth, text);
+    forth_flushOutput(fth);
+    free(text);
+  }
+
+  if(fth)
+    forth_freeInstance(fth);
+  return 0;
+}
+
+void forth_runJobs(ForthDict *d, const ForthSizes *sizes, bool jit,
+    ForthJob *jobs, int num, int threads)
+{
+  if(threads > num)
+    threads = num;
+  if(threads < 1)
+    threads = 1;
+
+  for(int i = 0; i < num; i++) {
+    jobs[i].output = 0;
+    jobs[i].output_size = 0;
+  }
+
+  ForthPool p = { d, sizes, jit, jobs, 0, threads };
+  p.workers = malloc(sizeof(ForthWorker)*threads);
+  for(int i = 0; i < threads; i++) {
+    ForthWorker *w = &p.workers[i];
+    pthread_mutex_init(&w->lock, 0);
+    w->next = (long)num*i / threads;
+    w->end = (long)num*(i+1) / threads;
+    w->pool = &p;
+  }
+
+  /* the calling thread is the first worker */
+  for(int i = 1; i < threads; i++)
+    if(pthread_create(&p.workers[i].thread, 0, forth_worker, &p.workers[i]))
+      p.workers[i].thread = 0;
+  forth_worker(&p.workers[0]);
+  for(int i = 1; i < threads; i++)
+    if(p.workers[i].thread)
+      pthread_join(p.workers[i].thread, 0);
+
+  for(int i = 0; i < threads; i++)
+    pthread_mutex_destroy(&p.workers[i].lock);
+  free(p.workers);
+
+  for(int i = 0; i < num; i++)
+    if(!jobs[i].output)
+      jobs[i].output = calloc(1, 1);
+}
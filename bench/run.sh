@@ -0,0 +1,88 @@
+# sh bench/run.sh [-n runs] [name=command ...]
+#
+# times every workload in bench/ under each command, the engines, and
+# prints the results as JSON. Each engine defaults to ./sforth and
+# ./sforth --jit. A run's time is wall clock seconds including startup,
+# min and median are what to compare. correct says whether the engine
+# printed what the workload's "cksum of the output" line says it should,
+# same_output whether it printed what the first engine did
+
+runs=5
+if [ "$1" = "-n" ]; then
+  runs=$2
+  shift 2
+fi
+if [ $# -eq 0 ]; then
+  set -- "threaded=./sforth" "jit=./sforth --jit"
+fi
+
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# compile: defining a large vocabulary, a hundred leaves and then words
+# that each call two of them
+awk 'BEGIN {
+  print "\\ cksum of the output: 3782722211 5"
+  for(i = 0; i < 100; i++)
+    printf ": W%d %d ;\n", i, i
+  for(; i < 50000; i++)
+    printf ": W%d W%d W%d + DUP 3 MOD DROP ;\n", i, i % 100, i % 97
+  print "W49999 . CR"
+}' > "$tmp/compile.fth"
+
+workloads="$dir/fib.fth $dir/loops.fth $dir/memory.fth $dir/output.fth"
+workloads="$workloads $dir/sieve.fth $tmp/compile.fth"
+
+now() {
+  date +%s%N
+}
+
+printf '{\n  "runs": %d,\n  "results": [' "$runs"
+sep=""
+for file in $workloads; do
+  name=$(basename "$file" .fth)
+  known=$(sed -n 's/^\\ cksum of the output: //p' "$file")
+  expected=""
+  for engine in "$@"; do
+    label=${engine%%=*}
+    command=${engine#*=}
+
+    times=""
+    for i in $(seq "$runs"); do
+      start=$(now)
+      $command "$file" > "$tmp/out"
+      end=$(now)
+      times="$times $((end - start))"
+    done
+
+    sum=$(cksum < "$tmp/out")
+    [ -z "$expected" ] && expected=$sum
+    same=false
+    [ "$sum" = "$expected" ] && same=true
+    correct=false
+    [ "$sum" = "$known" ] && correct=true
+
+    printf '%s\n    ' "$sep"
+    echo "$times" | tr ' ' '\n' | grep . | awk \
+      -v workload="$name" -v engine="$label" -v same="$same" \
+      -v correct="$correct" '
+      { t[NR] = $1 / 1e9; total += t[NR] }
+      END {
+        printf "{\"workload\": \"%s\", \"engine\": \"%s\", \"times\": [",
+          workload, engine
+        for(i = 1; i <= NR; i++) {
+          printf "%s%.4f", (i > 1 ? ", " : ""), t[i]
+          for(j = i; j > 1 && s[j-1] > t[i]; j--)
+            s[j] = s[j-1]
+          s[j] = t[i]
+        }
+        median = NR % 2 ? s[(NR+1)/2] : (s[NR/2] + s[NR/2+1]) / 2
+        printf "], \"min\": %.4f, \"median\": %.4f, \"mean\": %.4f, ",
+          s[1], median, total / NR
+        printf "\"correct\": %s, \"same_output\": %s}", correct, same
+      }'
+    sep=","
+  done
+done
+printf '\n  ]\n}\n'
@@ -0,0 +1,231 @@
+/* sforth - tdwsl 2022 */
+
+/* data space and BLOCK storage. Data space is a reservation of
+ * max_memory bytes, of which ALLOT makes more accessible as it goes, and
+ * no page of it costs anything before it is touched. Opening a block
+ * file moves it to the start of a reservation big enough for
+ * FORTH_MAX_BLOCKS blocks after it as well, and maps the file there
+ * privately, so block n is plain memory n*FORTH_BLOCK_SIZE bytes past the
+ * end of data space and its pages are only read in when touched. Nothing
+ * reaches the file until FLUSH writes the blocks UPDATE marked, one write
+ * per run of neighbouring blocks */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "forth.h"
+
+#define FORTH_WINDOW_SIZE ((long)FORTH_MAX_BLOCKS*FORTH_BLOCK_SIZE)
+
+static long forth_pageUp(long n) {
+  long page = sysconf(_SC_PAGESIZE);
+  return (n + page-1) / page * page;
+}
+
+/* where block 0 starts, as an address and in memory */
+static long forth_windowAt(ForthInstance *fth) {
+  return forth_pageUp(fth->max_memory);
+}
+
+static unsigned char *forth_window(ForthInstance *fth) {
+  return fth->memory + forth_windowAt(fth);
+}
+
+bool forth_mapMemory(ForthInstance *fth) {
+  unsigned char *m = mmap(0, forth_windowAt(fth), PROT_NONE,
+      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if(m == MAP_FAILED)
+    return false;
+  if(mprotect(m, forth_pageUp(fth->memory_size), PROT_READ|PROT_WRITE)
+      == -1) {
+    munmap(m, forth_windowAt(fth));
+    return false;
+  }
+  fth->memory = m;
+  return true;
+}
+
+/* makes the first size bytes of data space accessible, false past
+ * max_memory */
+bool forth_growMemory(ForthInstance *fth, long size) {
+  if(size <= fth->memory_size)
+    return true;
+  if(size > fth->max_memory)
+    return false;
+
+  long from = forth_pageUp(fth->memory_size), to = forth_pageUp(size);
+  if(to > from && mprotect(fth->memory + from, to - from,
+        PROT_READ|PROT_WRITE) == -1)
+    return false;
+  fth->memory_size = size;
+  return true;
+}
+
+/* data space moves into the reservation the first time a file is opened.
+ * Only its accessible pages are moved, and they are not copied */
+static bool forth_reserveWindow(ForthInstance *fth) {
+  if(fth->block.window)
+    return true;
+
+  long size = forth_windowAt(fth) + FORTH_WINDOW_SIZE;
+  long used = forth_pageUp(fth->memory_size);
+  unsigned char *base = mmap(0, size, PROT_NONE,
+      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if(base == MAP_FAILED)
+    return false;
+  if(mremap(fth->memory, used, used, MREMAP_MAYMOVE|MREMAP_FIXED, base)
+      == MAP_FAILED) {
+    munmap(base, size);
+    return false;
+  }
+
+  if(used < forth_windowAt(fth))
+    munmap(fth->memory + used, forth_windowAt(fth) - used);
+  fth->memory = base;
+  fth->block.window = true;
+  return true;
+}
+
+/* maps the file from fth->block.mapped up to bytes */
+static bool forth_mapBlocks(ForthInstance *fth, long bytes) {
+  long end = forth_pageUp(bytes);
+  if(end <= fth->block.mapped)
+    return true;
+  if(mmap(forth_window(fth) + fth->block.mapped, end - fth->block.mapped,
+        PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fth->block.fd,
+        fth->block.mapped) == MAP_FAILED)
+    return false;
+  fth->block.mapped = end;
+  return true;
+}
+
+/* makes the file n blocks long, blocks past its end read as zeros */
+static bool forth_growBlocks(ForthInstance *fth, int n) {
+  if(ftruncate(fth->block.fd, (long)n*FORTH_BLOCK_SIZE) == -1
+      || !forth_mapBlocks(fth, (long)n*FORTH_BLOCK_SIZE))
+    return false;
+
+  fth->block.updated = realloc(fth->block.updated, n);
+  memset(fth->block.updated + fth->block.size, 0, n - fth->block.size);
+  fth->block.size = n;
+  return true;
+}
+
+/* flushes and closes the block file, leaving the reservation in place for
+ * the next one */
+static void forth_closeBlocks(ForthInstance *fth) {
+  if(fth->block.fd != -1) {
+    forth_flush(fth);
+    if(fth->block.mapped)
+      mmap(forth_window(fth), fth->block.mapped, PROT_NONE,
+          MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0);
+    close(fth->block.fd);
+  }
+  if(fth->block.updated)
+    free(fth->block.updated);
+
+  fth->block.fd = -1;
+  fth->block.size = 0;
+  fth->block.mapped = 0;
+  fth->block.current = -1;
+  fth->block.updated = 0;
+}
+
+void forth_blockFile(ForthInstance *fth, const char *filename) {
+  forth_closeBlocks(fth);
+
+  struct stat st;
+  int fd = open(filename, O_RDWR|O_CREAT, 0644);
+  if(fd == -1 || fstat(fd, &st) == -1) {
+    forth_printf(fth, "failed to open %s\n", filename);
+    if(fd != -1)
+      close(fd);
+    return;
+  }
+  if(st.st_size > FORTH_WINDOW_SIZE || !forth_reserveWindow(fth)) {
+    forth_printf(fth, "failed to map %s\n", filename);
+    close(fd);
+    return;
+  }
+
+  fth->block.fd = fd;
+  if(!forth_mapBlocks(fth, st.st_size)) {
+    forth_printf(fth, "failed to map %s\n", filename);
+    forth_closeBlocks(fth);
+    return;
+  }
+
+  /* a partial block at the end is only padded out once it is used */
+  fth->block.size = st.st_size / FORTH_BLOCK_SIZE;
+  fth->block.updated = calloc(fth->block.size ? fth->block.size : 1, 1);
+}
+
+/* BLOCK and BUFFER, the address of block n */
+int forth_block(ForthInstance *fth, int n) {
+  if(fth->block.fd == -1) {
+    forth_printf(fth, "no block file !\n");
+    return 0;
+  }
+  if(n < 0 || n >= FORTH_MAX_BLOCKS) {
+    forth_printf(fth, "block %d out of range !\n", n);
+    return 0;
+  }
+  if(n >= fth->block.size && !forth_growBlocks(fth, n+1)) {
+    forth_printf(fth, "failed to extend block file !\n");
+    return 0;
+  }
+
+  fth->block.current = n;
+  return forth_windowAt(fth) + n*FORTH_BLOCK_SIZE;
+}
+
+void forth_update(ForthInstance *fth) {
+  if(fth->block.current != -1)
+    fth->block.updated[fth->block.current] = 1;
+}
+
+/* writes every updated block, then drops the private copies of all of
+ * them so that the mapping reads the file again. Blocks changed without
+ * UPDATE lose their changes here, as FLUSH empties every buffer */
+void forth_flush(ForthInstance *fth) {
+  if(fth->block.fd == -1)
+    return;
+
+  unsigned char *window = forth_window(fth);
+  bool ok = true;
+  for(int i = 0; i < fth->block.size; i++) {
+    if(!fth->block.updated[i])
+      continue;
+
+    int n = 0;
+    while(i+n < fth->block.size && fth->block.updated[i+n])
+      fth->block.updated[i+n++] = 0;
+
+    long at = (long)i*FORTH_BLOCK_SIZE, size = (long)n*FORTH_BLOCK_SIZE;
+    if(pwrite(fth->block.fd, window+at, size, at) != size)
+      ok = false;
+    i += n-1;
+  }
+
+  if(!ok)
+    forth_printf(fth, "failed to write block file !\n");
+  else if(fth->block.mapped)
+    madvise(window, fth->block.mapped, MADV_DONTNEED);
+  fth->block.current = -1;
+}
+
+/* closes the block file and frees data space along with the reservation */
+void forth_freeBlocks(ForthInstance *fth) {
+  forth_closeBlocks(fth);
+  if(fth->memory)
+    munmap(fth->memory, forth_windowAt(fth)
+        + (fth->block.window ? FORTH_WINDOW_SIZE : 0));
+  fth->memory = 0;
+  fth->block.window = false;
+}
@@ -1 +1,52 @@
-gcc forth.c interpreter.c -o sforth
+src="forth.c jit.c emit.c image.c block.c freeze.c batch.c profile.c task.c interpreter.c"
+gcc $src -o sforth -lpthread
+
+# sh compile.sh test-c translates test.fth to C, builds the result and
+# checks that it prints what the interpreter does
+if [ "$1" = "test-c" ]; then
+  ./sforth --emit-c test.fth > test_fth.c 2> /dev/null &&
+  gcc -O2 test_fth.c -o test_fth &&
+  ./sforth test.fth > test_fth.expected &&
+  ./test_fth | cmp - test_fth.expected &&
+  echo "test.fth: translated program matches the interpreter"
+  rm -f test_fth.c test_fth test_fth.expected
+
+  # top level code that ran SQ through F would now run the new SQ
+  echo ': SQ DUP * ; : F 10 0 DO I SQ . LOOP CR ; F : SQ 3 * ; F' \
+    > test_redefine.fth
+  ./sforth --emit-c test_redefine.fth 2>&1 > /dev/null |
+    grep -q "SQ redefined after it ran" &&
+  echo "test_redefine.fth: redefinition after running is reported"
+  rm -f test_redefine.fth
+fi
+
+# sh compile.sh test-tasks runs a task that never ends next to one that
+# does and checks that STOP at top level ends the first
+if [ "$1" = "test-tasks" ]; then
+  cat > test_tasks.fth <<'END'
+: S BEGIN 1 . PAUSE 0 UNTIL ;
+: C 3 0 DO I . PAUSE LOOP ;
+CREATE T 1 CELLS ALLOT
+TASK S T !
+0 T @ START
+TASK C 0 SWAP START
+T @ STOP
+." done" CR
+END
+  echo "1 1 1 0 1 1 1 2 done" > test_tasks.expected
+  timeout 5 ./sforth test_tasks.fth | cmp - test_tasks.expected &&
+  echo "test_tasks.fth: STOP ends a task that loops forever"
+  rm -f test_tasks.fth test_tasks.expected
+fi
+
+# sh compile.sh bench [-n runs] times the workloads in bench/ on optimized
+# builds of both dispatch loops and the JIT and prints JSON, see
+# bench/run.sh
+if [ "$1" = "bench" ]; then
+  shift
+  gcc -O2 $src -o sforth_threaded -lpthread &&
+  gcc -O2 -DFORTH_SWITCH $src -o sforth_switch -lpthread &&
+  sh bench/run.sh "$@" "threaded=./sforth_threaded" \
+    "switch=./sforth_switch" "jit=./sforth_threaded --jit"
+  rm -f sforth_threaded sforth_switch
+fi
@@ -0,0 +1,637 @@
+/* sforth - tdwsl 2022 */
+
+/* C back end. forth_emitFile runs a script once, recording its top level
+ * code, and then writes the user dictionary out as a C program. Every
+ * word becomes a function c<n> that follows engine.h op for op, and a
+ * word forth_verifyWord proved safe also gets w<n>, which keeps its stack
+ * slots and loop counters in local variables. w<n> is called wherever
+ * the guard that picks the unchecked engine would pass */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "forth.h"
+
+/* the generated program has no block file to map */
+#define FORTH_NOBLOCKS \
+  "  forth_putString(fth,\n" \
+  "      \"block words are not supported by --emit-c !\\n\");\n"
+
+/* nor tasks to switch between */
+#define FORTH_NOTASKS \
+  "  forth_putString(fth,\n" \
+  "      \"tasks are not supported by --emit-c !\\n\");\n"
+
+static void forth_emitString(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for(; *s; s++) {
+    if(*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if(*s < ' ' || *s > '~')
+      fprintf(fp, "\\%03o", (unsigned char)*s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+/* identifier inside a comment, without closing or opening another */
+static void forth_emitName(FILE *fp, const char *s) {
+  for(int i = 0; s[i]; i++) {
+    if(s[i] == '/' && ((i && s[i-1] == '*') || s[i+1] == '*'))
+      fputc(' ', fp);
+    fputc(s[i], fp);
+  }
+}
+
+/* marks the instructions a jump lands on, including the end of the word */
+static bool *forth_emitTargets(ForthWord *w) {
+  bool *target = calloc(w->size+1, sizeof(bool));
+  for(int pc = 0; pc < w->size; pc += forth_opSize(w->program[pc]))
+    if(forth_opSize(w->program[pc]) > 1) {
+      switch(w->program[pc]) {
+      case FORTH_JUMP:
+      case FORTH_JZ:
+      case FORTH_JNZ:
+      case FORTH_LOOP:
+      case FORTH_LOOPPLUS:
+        target[w->program[pc+1]] = true;
+        break;
+      case FORTH_TAILCALL:
+        target[w->size] = true;
+        break;
+      }
+    }
+  return target;
+}
+
+static void forth_emitCall(FILE *fp, ForthInstance *fth, int index) {
+  ForthWord *w = &fth->dict.words[index];
+  if(w->safe)
+    fprintf(fp, "  if(FITS(%d, %d, %d))\n    w%d();\n  else\n    c%d();\n",
+        w->need, w->peak, w->lpeak, index, index);
+  else
+    fprintf(fp, "  c%d();\n", index);
+}
+
+/* one instruction through the checked stack operations */
+static void forth_emitChecked(FILE *fp, ForthInstance *fth, ForthWord *w,
+    int index, int pc, bool top)
+{
+  int op = w->program[pc];
+  int arg = forth_opSize(op) > 1 ? w->program[pc+1] : 0;
+  const char *binary = 0, *literal = 0;
+
+  switch(op) {
+  case FORTH_PUSH:
+    fprintf(fp, "  PUSH(%d);\n", arg);
+    break;
+  case FORTH_PLUS: binary = "+"; break;
+  case FORTH_MINUS: binary = "-"; break;
+  case FORTH_MUL: binary = "*"; break;
+  case FORTH_DIV: binary = "/"; break;
+  case FORTH_MOD: binary = "%"; break;
+  case FORTH_LESS: binary = "<"; break;
+  case FORTH_GREATER: binary = ">"; break;
+  case FORTH_EQUAL: binary = "=="; break;
+  case FORTH_ADDLIT: literal = "+"; break;
+  case FORTH_MULLIT: literal = "*"; break;
+  case FORTH_DIVLIT: literal = "/"; break;
+  case FORTH_MODLIT: literal = "%"; break;
+  case FORTH_LESSLIT: literal = "<"; break;
+  case FORTH_GREATERLIT: literal = ">"; break;
+  case FORTH_EQUALLIT: literal = "=="; break;
+  case FORTH_DUP:
+    fprintf(fp, "  n1 = POP();\n  PUSH(n1);\n  PUSH(n1);\n");
+    break;
+  case FORTH_SWAP:
+    fprintf(fp, "  if(HAS(2)) {\n"
+        "    n1 = fth->stack[fth->sp-1];\n"
+        "    fth->stack[fth->sp-1] = fth->stack[fth->sp-2];\n"
+        "    fth->stack[fth->sp-2] = n1;\n  }\n");
+    break;
+  case FORTH_DROP:
+    fprintf(fp, "  (void)POP();\n");
+    break;
+  case FORTH_ROT:
+    fprintf(fp, "  if(HAS(3)) {\n"
+        "    n1 = fth->stack[fth->sp-1];\n"
+        "    fth->stack[fth->sp-1] = fth->stack[fth->sp-3];\n"
+        "    fth->stack[fth->sp-3] = fth->stack[fth->sp-2];\n"
+        "    fth->stack[fth->sp-2] = n1;\n  }\n");
+    break;
+  case FORTH_OVER:
+    fprintf(fp, "  if(HAS(2)) {\n"
+        "    n1 = fth->stack[fth->sp-2];\n    PUSH(n1);\n  }\n");
+    break;
+  case FORTH_DEPTH:
+    fprintf(fp, "  n1 = fth->sp;\n  PUSH(n1);\n");
+    break;
+  case FORTH_FULLSTOP:
+    fprintf(fp, "  forth_putNumber(fth, POP());\n");
+    break;
+  case FORTH_CR:
+    fprintf(fp, "  forth_putChar(fth, '\\n');\n");
+    break;
+  case FORTH_CALL:
+    if(top) {
+      fprintf(fp, "  lbase = fth->lsp;\n  if(!setjmp(top)) {\n");
+      forth_emitCall(fp, fth, arg);
+      fprintf(fp, "  }\n  else\n    fth->lsp = lbase;\n  fth->rsp = 0;\n");
+    }
+    else {
+      fprintf(fp, "  ENTER();\n");
+      forth_emitCall(fp, fth, arg);
+      fprintf(fp, "  LEAVE();\n");
+    }
+    break;
+  case FORTH_TAILCALL:
+    forth_emitCall(fp, fth, arg);
+    fprintf(fp, "  return;\n");
+    break;
+  case FORTH_RECURSE:
+    fprintf(fp, "  ENTER();\n  c%d();\n  LEAVE();\n", index);
+    break;
+  case FORTH_JUMP:
+    fprintf(fp, "  goto L%d;\n", arg);
+    break;
+  case FORTH_JZ:
+    fprintf(fp, "  if(!POP())\n    goto L%d;\n", arg);
+    break;
+  case FORTH_JNZ:
+    fprintf(fp, "  if(POP())\n    goto L%d;\n", arg);
+    break;
+  case FORTH_DO:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  fth->lstack[fth->lsp++] = n1;\n"
+        "  fth->lstack[fth->lsp++] = n2;\n");
+    break;
+  case FORTH_LOOPPLUS:
+  case FORTH_LOOP:
+    if(op == FORTH_LOOPPLUS)
+      fprintf(fp, "  n1 = POP();\n  fth->lstack[fth->lsp-2] += n1 - 1;\n");
+    fprintf(fp, "  if(++fth->lstack[fth->lsp-2] < fth->lstack[fth->lsp-1])\n"
+        "    goto L%d;\n  fth->lsp -= 2;\n", arg);
+    break;
+  case FORTH_I:
+    fprintf(fp, "  n1 = fth->lstack[fth->lsp-2];\n  PUSH(n1);\n");
+    break;
+  case FORTH_INC:
+    fprintf(fp, "  if(HAS(1))\n    fth->stack[fth->sp-1]++;\n");
+    break;
+  case FORTH_DEC:
+    fprintf(fp, "  if(HAS(1))\n    fth->stack[fth->sp-1]--;\n");
+    break;
+  case FORTH_PUTSTR:
+    fprintf(fp, "  forth_putString(fth, ");
+    forth_emitString(fp, w->strings[arg]);
+    fprintf(fp, ");\n");
+    break;
+  case FORTH_BYE:
+    fprintf(fp, "  exit(0);\n");
+    break;
+  case FORTH_HERE:
+    fprintf(fp, "  PUSH(fth->here);\n");
+    break;
+  case FORTH_ALLOT:
+    fprintf(fp, "  n1 = POP();\n  fth->here += n1;\n");
+    break;
+  case FORTH_SETMEM:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  forth_store(fth, n1, n2);\n");
+    break;
+  case FORTH_GETMEM:
+    fprintf(fp, "  n1 = POP();\n  PUSH(forth_fetch(fth, n1));\n");
+    break;
+  case FORTH_CSETMEM:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n  fth->memory[n1] = n2;\n");
+    break;
+  case FORTH_CGETMEM:
+    fprintf(fp, "  n1 = POP();\n  PUSH(fth->memory[n1]);\n");
+    break;
+  case FORTH_MOVE:
+  case FORTH_CMOVE:
+  case FORTH_FILL:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  forth_%s(fth, POP(), n2, n1);\n",
+        op == FORTH_MOVE ? "move" : op == FORTH_CMOVE ? "cmove" : "fill");
+    break;
+  case FORTH_SUM:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  PUSH(forth_sum(fth, n2, n1));\n");
+    break;
+  case FORTH_VMIN:
+  case FORTH_VMAX:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  PUSH(forth_extreme(fth, n2, n1, %d));\n", op == FORTH_VMAX);
+    break;
+  case FORTH_DOT:
+  case FORTH_COUNTEQ:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  n2 = forth_%s(fth, POP(), n2, n1);\n  PUSH(n2);\n",
+        op == FORTH_DOT ? "dot" : "countEqual");
+    break;
+  case FORTH_SORT:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n  forth_sort(fth, n2, n1);\n");
+    break;
+  case FORTH_BSEARCH:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  n2 = forth_bsearch(fth, POP(), n2, n1);\n  PUSH(n2);\n");
+    break;
+  case FORTH_TABLENEW:
+    fprintf(fp, "  n1 = POP();\n  PUSH(forth_tableAllot(fth, n1));\n");
+    break;
+  case FORTH_TABLEPUT:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  forth_tablePut(fth, n1, n2, POP());\n");
+    break;
+  case FORTH_TABLEGET:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  n2 = forth_tableFind(fth, n1, n2);\n"
+        "  PUSH(n2 == -1 ? 0 : forth_fetch(fth, n2));\n"
+        "  PUSH(n2 != -1);\n");
+    break;
+  case FORTH_VADD:
+  case FORTH_VMUL:
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n"
+        "  { int b = POP();\n"
+        "    forth_map(fth, POP(), b, n2, n1, %d); }\n", op == FORTH_VMUL);
+    break;
+  case FORTH_EMIT:
+    fprintf(fp, "  forth_putChar(fth, POP());\n");
+    break;
+  case FORTH_BLOCK:
+  case FORTH_BUFFER:
+    fprintf(fp, "  (void)POP();\n" FORTH_NOBLOCKS "  PUSH(0);\n");
+    break;
+  case FORTH_UPDATE:
+  case FORTH_FLUSH:
+    fprintf(fp, FORTH_NOBLOCKS);
+    break;
+  case FORTH_TASK:
+    fprintf(fp, "  (void)POP();\n" FORTH_NOTASKS "  PUSH(0);\n");
+    break;
+  case FORTH_START:
+    fprintf(fp, "  (void)POP();\n  (void)POP();\n" FORTH_NOTASKS);
+    break;
+  case FORTH_STOP:
+    fprintf(fp, "  (void)POP();\n" FORTH_NOTASKS);
+    break;
+  case FORTH_SQUARE:
+    fprintf(fp, "  n1 = POP();\n  PUSH(n1*n1);\n");
+    break;
+  case FORTH_NIP:
+    fprintf(fp, "  if(HAS(2)) {\n"
+        "    fth->stack[fth->sp-2] = fth->stack[fth->sp-1];\n"
+        "    (void)POP();\n  }\n  else\n    (void)POP();\n");
+    break;
+  case FORTH_2DUP:
+    fprintf(fp, "  if(HAS(2)) {\n"
+        "    n1 = fth->stack[fth->sp-2];\n"
+        "    n2 = fth->stack[fth->sp-1];\n"
+        "    PUSH(n1);\n    PUSH(n2);\n  }\n  else\n    HAS(2);\n");
+    break;
+  }
+
+  if(binary)
+    fprintf(fp, "  n1 = POP();\n  n2 = POP();\n  PUSH(n2 %s n1);\n", binary);
+  if(literal)
+    fprintf(fp, "  n2 = POP();\n  PUSH(n2 %s %d);\n", literal, arg);
+}
+
+static void forth_emitCheckedWord(FILE *fp, ForthInstance *fth,
+    ForthWord *w, int index)
+{
+  bool top = index < 0;
+  bool *target = forth_emitTargets(w);
+
+  if(top)
+    fprintf(fp, "static void forth_main() {\n  int n1, n2, lbase;\n");
+  else {
+    fprintf(fp, "/* ");
+    forth_emitName(fp, w->identifier);
+    fprintf(fp, " */\nstatic void c%d() {\n  int n1, n2;\n", index);
+  }
+
+  for(int pc = 0; pc < w->size; pc += forth_opSize(w->program[pc])) {
+    if(target[pc])
+      fprintf(fp, "L%d:\n", pc);
+    forth_emitChecked(fp, fth, w, index, pc, top);
+  }
+  if(target[w->size])
+    fprintf(fp, "L%d:\n  ;\n", w->size);
+  fprintf(fp, "}\n\n");
+
+  free(target);
+}
+
+/* a safe word with stack slot k in s<k>, counted from the deepest value
+ * it needs, so that the depths the verifier found name its variables */
+static void forth_emitFastWord(FILE *fp, ForthInstance *fth, int index) {
+  ForthWord *w = &fth->dict.words[index];
+  int *depth = malloc(sizeof(int)*(w->size+1));
+  int *ldepth = malloc(sizeof(int)*(w->size+1));
+  forth_verifyDepths(fth, w, depth, ldepth);
+  bool *target = forth_emitTargets(w);
+  int need = w->need, end = w->need + w->effect;
+
+  fprintf(fp, "static void w%d() {\n  int base = fth->sp - %d;\n  int n1", index,
+      need);
+  for(int k = 0; k < need + w->peak; k++)
+    fprintf(fp, ", s%d", k);
+  for(int k = 0; k < w->lpeak; k++)
+    fprintf(fp, ", l%d", k);
+  fprintf(fp, ";\n");
+  for(int k = 0; k < need; k++)
+    fprintf(fp, "  s%d = fth->stack[base+%d];\n", k, k);
+
+  for(int pc = 0; pc < w->size; pc += forth_opSize(w->program[pc])) {
+    if(target[pc])
+      fprintf(fp, "L%d:\n", pc);
+    if(depth[pc] == FORTH_UNKNOWN)
+      continue;
+
+    int op = w->program[pc];
+    int arg = forth_opSize(op) > 1 ? w->program[pc+1] : 0;
+    int t = depth[pc] + need, l = ldepth[pc];
+    const char *binary = 0, *literal = 0;
+
+    switch(op) {
+    case FORTH_PUSH:
+      fprintf(fp, "  s%d = %d;\n", t, arg);
+      break;
+    case FORTH_PLUS: binary = "+"; break;
+    case FORTH_MINUS: binary = "-"; break;
+    case FORTH_MUL: binary = "*"; break;
+    case FORTH_DIV: binary = "/"; break;
+    case FORTH_MOD: binary = "%"; break;
+    case FORTH_LESS: binary = "<"; break;
+    case FORTH_GREATER: binary = ">"; break;
+    case FORTH_EQUAL: binary = "=="; break;
+    case FORTH_ADDLIT: literal = "+"; break;
+    case FORTH_MULLIT: literal = "*"; break;
+    case FORTH_DIVLIT: literal = "/"; break;
+    case FORTH_MODLIT: literal = "%"; break;
+    case FORTH_LESSLIT: literal = "<"; break;
+    case FORTH_GREATERLIT: literal = ">"; break;
+    case FORTH_EQUALLIT: literal = "=="; break;
+    case FORTH_DUP:
+      fprintf(fp, "  s%d = s%d;\n", t, t-1);
+      break;
+    case FORTH_OVER:
+      fprintf(fp, "  s%d = s%d;\n", t, t-2);
+      break;
+    case FORTH_SWAP:
+      fprintf(fp, "  n1 = s%d;\n  s%d = s%d;\n  s%d = n1;\n",
+          t-1, t-1, t-2, t-2);
+      break;
+    case FORTH_ROT:
+      fprintf(fp, "  n1 = s%d;\n  s%d = s%d;\n  s%d = s%d;\n  s%d = n1;\n",
+          t-1, t-1, t-3, t-3, t-2, t-2);
+      break;
+    case FORTH_NIP:
+      fprintf(fp, "  s%d = s%d;\n", t-2, t-1);
+      break;
+    case FORTH_2DUP:
+      fprintf(fp, "  s%d = s%d;\n  s%d = s%d;\n", t, t-2, t+1, t-1);
+      break;
+    case FORTH_SQUARE:
+      fprintf(fp, "  s%d *= s%d;\n", t-1, t-1);
+      break;
+    case FORTH_INC:
+      fprintf(fp, "  s%d++;\n", t-1);
+      break;
+    case FORTH_DEC:
+      fprintf(fp, "  s%d--;\n", t-1);
+      break;
+    case FORTH_DROP:
+      break;
+    case FORTH_DEPTH:
+      fprintf(fp, "  s%d = base + %d;\n", t, t);
+      break;
+    case FORTH_FULLSTOP:
+      fprintf(fp, "  forth_putNumber(fth, s%d);\n", t-1);
+      break;
+    case FORTH_CR:
+      fprintf(fp, "  forth_putChar(fth, '\\n');\n");
+      break;
+    case FORTH_EMIT:
+      fprintf(fp, "  forth_putChar(fth, s%d);\n", t-1);
+      break;
+    case FORTH_BLOCK:
+    case FORTH_BUFFER:
+      fprintf(fp, FORTH_NOBLOCKS "  s%d = 0;\n", t-1);
+      break;
+    case FORTH_UPDATE:
+    case FORTH_FLUSH:
+      fprintf(fp, FORTH_NOBLOCKS);
+      break;
+    case FORTH_TASK:
+      fprintf(fp, FORTH_NOTASKS "  s%d = 0;\n", t-1);
+      break;
+    case FORTH_START:
+      fprintf(fp, FORTH_NOTASKS);
+      break;
+    case FORTH_PUTSTR:
+      fprintf(fp, "  forth_putString(fth, ");
+      forth_emitString(fp, w->strings[arg]);
+      fprintf(fp, ");\n");
+      break;
+    case FORTH_HERE:
+      fprintf(fp, "  s%d = fth->here;\n", t);
+      break;
+    case FORTH_ALLOT:
+      fprintf(fp, "  fth->here += s%d;\n", t-1);
+      break;
+    case FORTH_SETMEM:
+      fprintf(fp, "  forth_store(fth, s%d, s%d);\n", t-1, t-2);
+      break;
+    case FORTH_GETMEM:
+      fprintf(fp, "  s%d = forth_fetch(fth, s%d);\n", t-1, t-1);
+      break;
+    case FORTH_CSETMEM:
+      fprintf(fp, "  fth->memory[s%d] = s%d;\n", t-1, t-2);
+      break;
+    case FORTH_CGETMEM:
+      fprintf(fp, "  s%d = fth->memory[s%d];\n", t-1, t-1);
+      break;
+    case FORTH_MOVE:
+    case FORTH_CMOVE:
+    case FORTH_FILL:
+      fprintf(fp, "  forth_%s(fth, s%d, s%d, s%d);\n",
+          op == FORTH_MOVE ? "move" : op == FORTH_CMOVE ? "cmove" : "fill",
+          t-3, t-2, t-1);
+      break;
+    case FORTH_SUM:
+      fprintf(fp, "  s%d = forth_sum(fth, s%d, s%d);\n", t-2, t-2, t-1);
+      break;
+    case FORTH_VMIN:
+    case FORTH_VMAX:
+      fprintf(fp, "  s%d = forth_extreme(fth, s%d, s%d, %d);\n",
+          t-2, t-2, t-1, op == FORTH_VMAX);
+      break;
+    case FORTH_DOT:
+    case FORTH_COUNTEQ:
+      fprintf(fp, "  s%d = forth_%s(fth, s%d, s%d, s%d);\n", t-3,
+          op == FORTH_DOT ? "dot" : "countEqual", t-3, t-2, t-1);
+      break;
+    case FORTH_SORT:
+      fprintf(fp, "  forth_sort(fth, s%d, s%d);\n", t-2, t-1);
+      break;
+    case FORTH_BSEARCH:
+      fprintf(fp, "  s%d = forth_bsearch(fth, s%d, s%d, s%d);\n",
+          t-3, t-3, t-2, t-1);
+      break;
+    case FORTH_TABLENEW:
+      fprintf(fp, "  s%d = forth_tableAllot(fth, s%d);\n", t-1, t-1);
+      break;
+    case FORTH_TABLEPUT:
+      fprintf(fp, "  forth_tablePut(fth, s%d, s%d, s%d);\n",
+          t-1, t-2, t-3);
+      break;
+    case FORTH_TABLEGET:
+      fprintf(fp, "  s%d = forth_tableFind(fth, s%d, s%d);\n"
+          "  s%d = s%d == -1 ? 0 : forth_fetch(fth, s%d);\n"
+          "  s%d = s%d != -1;\n",
+          t-1, t-1, t-2, t-2, t-1, t-1, t-1, t-1);
+      break;
+    case FORTH_VADD:
+    case FORTH_VMUL:
+      fprintf(fp, "  forth_map(fth, s%d, s%d, s%d, s%d, %d);\n",
+          t-4, t-3, t-2, t-1, op == FORTH_VMUL);
+      break;
+    case FORTH_JUMP:
+      fprintf(fp, "  goto L%d;\n", arg);
+      break;
+    case FORTH_JZ:
+      fprintf(fp, "  if(!s%d)\n    goto L%d;\n", t-1, arg);
+      break;
+    case FORTH_JNZ:
+      fprintf(fp, "  if(s%d)\n    goto L%d;\n", t-1, arg);
+      break;
+    case FORTH_DO:
+      fprintf(fp, "  l%d = s%d;\n  l%d = s%d;\n", l, t-1, l+1, t-2);
+      break;
+    case FORTH_LOOP:
+      fprintf(fp, "  if(++l%d < l%d)\n    goto L%d;\n", l-2, l-1, arg);
+      break;
+    case FORTH_LOOPPLUS:
+      fprintf(fp, "  l%d += s%d;\n  if(l%d < l%d)\n    goto L%d;\n",
+          l-2, t-1, l-2, l-1, arg);
+      break;
+    case FORTH_I:
+      fprintf(fp, "  s%d = l%d;\n", t, l-2);
+      break;
+    case FORTH_BYE:
+      fprintf(fp, "  exit(0);\n");
+      break;
+    case FORTH_CALL:
+    case FORTH_TAILCALL: {
+      /* only the values the callee can reach go through fth->stack */
+      ForthWord *c = &fth->dict.words[arg];
+      for(int k = t - c->need; k < t; k++)
+        fprintf(fp, "  fth->stack[base+%d] = s%d;\n", k, k);
+      fprintf(fp, "  fth->sp = base + %d;\n  w%d();\n", t, arg);
+      for(int k = t - c->need; k < t + c->effect; k++)
+        fprintf(fp, "  s%d = fth->stack[base+%d];\n", k, k);
+      if(op == FORTH_TAILCALL)
+        fprintf(fp, "  goto L%d;\n", w->size);
+      break;
+    }
+    }
+
+    if(binary)
+      fprintf(fp, "  s%d = s%d %s s%d;\n", t-2, t-2, binary, t-1);
+    if(literal)
+      fprintf(fp, "  s%d = s%d %s %d;\n", t-1, t-1, literal, arg);
+  }
+
+  if(target[w->size])
+    fprintf(fp, "L%d:\n", w->size);
+  for(int k = 0; k < end; k++)
+    fprintf(fp, "  fth->stack[base+%d] = s%d;\n", k, k);
+  fprintf(fp, "  fth->sp = base + %d;\n}\n\n", end);
+
+  free(depth);
+  free(ldepth);
+  free(target);
+}
+
+static void forth_emitProgram(FILE *fp, ForthInstance *fth, ForthWord *main,
+    const char *filename)
+{
+  fprintf(fp, "/* generated by sforth --emit-c from ");
+  forth_emitName(fp, filename);
+  fprintf(fp, " */\n\n"
+      "#include <stdio.h>\n"
+      "#include <stdlib.h>\n"
+      "#include <setjmp.h>\n"
+      "#include \"forth.h\"\n\n"
+      "static ForthInstance *fth;\n"
+      "static jmp_buf top;\n\n"
+      "#define POP() forth_pop(fth)\n"
+      "#define PUSH(n) forth_push(fth, n)\n"
+      "#define HAS(n) forth_has(fth, n)\n"
+      "#define FITS(need, peak, lpeak) (fth->sp >= (need) \\\n"
+      "    && fth->sp + (peak) <= fth->stack_size \\\n"
+      "    && fth->lsp + (lpeak) <= fth->lstack_size)\n"
+      "#define ENTER() \\\n"
+      "  if(fth->rsp >= fth->rstack_size) { \\\n"
+      "    forth_putString(fth, \"return stack overflow !\\n\"); \\\n"
+      "    longjmp(top, 1); \\\n"
+      "  } \\\n"
+      "  fth->rsp++\n"
+      "#define LEAVE() fth->rsp--\n\n");
+
+  for(int i = fth->dict.lock; i < fth->dict.size; i++) {
+    fprintf(fp, "static void c%d();\n", i);
+    if(fth->dict.words[i].safe)
+      fprintf(fp, "static void w%d();\n", i);
+  }
+  fprintf(fp, "\n");
+
+  for(int i = fth->dict.lock; i < fth->dict.size; i++) {
+    forth_emitCheckedWord(fp, fth, &fth->dict.words[i], i);
+    if(fth->dict.words[i].safe)
+      forth_emitFastWord(fp, fth, i);
+  }
+
+  forth_emitCheckedWord(fp, fth, main, -1);
+
+  fprintf(fp, "int main() {\n"
+      "  fth = forth_allocRuntime(0);\n"
+      "  forth_initRuntime(fth);\n"
+      "  fth->memory = calloc(fth->memory_size, 1);\n"
+      "  forth_main();\n"
+      "  forth_flushOutput(fth);\n"
+      "  free(fth->memory);\n"
+      "  forth_freeRuntime(fth);\n"
+      "  return 0;\n"
+      "}\n");
+}
+
+void forth_emitFile(const char *filename, FILE *fp) {
+  ForthInstance *fth = forth_newInstance();
+  ForthWord main;
+  forth_initWord(&main, "MAIN");
+  fth->record = &main;
+
+  /* the script runs once to build the dictionary and find the addresses
+   * CREATE hands out, what it prints meanwhile goes to stderr */
+  fflush(stdout);
+  int out = dup(1);
+  dup2(2, 1);
+  forth_runFile(fth, filename);
+  forth_flushOutput(fth);
+  fflush(stdout);
+  dup2(out, 1);
+  close(out);
+  fth->record = 0;
+
+  forth_emitProgram(fp, fth, &main, filename);
+
+  forth_freeWord(main);
+  forth_freeInstance(fth);
+}
@@ -0,0 +1,602 @@
+/* sforth - tdwsl 2022 */
+
+/* inner interpreter, included by forth.c once per variant. FORTH_ENGINE
+ * names the function, FORTH_CHECKED selects whether the data stack is
+ * accessed through forth_pop/forth_push or directly through a local stack
+ * pointer, which is only done for words forth_verifyWord proved safe.
+ * FORTH_PROFILE counts every opcode and times every call for profile.c,
+ * and so never hands a word to its native code.
+ *
+ * Calls push a frame onto fth->rstack and continue in the same loop, so
+ * running a word never recurses in C however deep the Forth calls go */
+
+#if FORTH_CHECKED
+#define SP fth->sp
+#define POP() forth_pop(fth)
+#define PUSH(n) forth_push(fth, n)
+#define HAS(n) forth_has(fth, n)
+#define SYNC()
+#define LOAD()
+#define FITS(w) forth_fits(fth, w)
+#else
+#define SP sp
+#define POP() fth->stack[--sp]
+#define PUSH(n) (fth->stack[sp++] = (n))
+#define HAS(n) true
+#define SYNC() fth->sp = sp
+#define LOAD() sp = fth->sp
+#define FITS(w) true
+#endif
+
+#if FORTH_PROFILE
+#define PROFILE_OP() forth_profileOp(fth, program[pc], pc)
+#define PROFILE_ENTER(w) forth_profileEnter(fth, w)
+#define PROFILE_LEAVE() forth_profileLeave(fth)
+#define NATIVE(w) false
+#else
+#define PROFILE_OP()
+#define PROFILE_ENTER(w)
+#define PROFILE_LEAVE()
+#define NATIVE(w) ((w)->jit && FITS(w))
+#endif
+
+/* gcc otherwise merges the dispatch at the end of every opcode into one
+ * shared indirect jump, which is the switch loop all over again */
+#if defined(FORTH_THREADED) && !defined(__clang__)
+__attribute__((optimize("no-gcse", "no-crossjumping")))
+#endif
+static void FORTH_ENGINE(ForthInstance *fth, ForthWord *w) {
+  if(fth->quit)
+    return;
+
+  int pc = 0;
+  int n1, n2;
+  int base = fth->rsp, lbase = fth->lsp;
+#if FORTH_CHECKED && !FORTH_PROFILE
+  /* no word resumes a task from the frame its PAUSE pushed, its stacks
+   * are all its own so it runs from the bottom of them */
+  if(!w) {
+    base = lbase = 0;
+    w = fth->rstack[--fth->rsp].word;
+    pc = fth->rstack[fth->rsp].pc;
+  }
+#endif
+  /* the running word's program is kept in locals, stores to the stacks
+   * would otherwise force it to be reloaded through w on every dispatch */
+  int *program = w->program;
+  int size = w->size;
+#if !FORTH_CHECKED
+  int sp = fth->sp;
+#endif
+#if FORTH_PROFILE
+  int pbase = forth_profileEnter(fth, w);
+#endif
+
+#ifdef FORTH_THREADED
+  static void *labels[] = {
+    [FORTH_PUSH] = &&op_FORTH_PUSH,
+    [FORTH_DROP] = &&op_FORTH_DROP,
+    [FORTH_PLUS] = &&op_FORTH_PLUS,
+    [FORTH_MINUS] = &&op_FORTH_MINUS,
+    [FORTH_DIV] = &&op_FORTH_DIV,
+    [FORTH_MUL] = &&op_FORTH_MUL,
+    [FORTH_MOD] = &&op_FORTH_MOD,
+    [FORTH_DUP] = &&op_FORTH_DUP,
+    [FORTH_OVER] = &&op_FORTH_OVER,
+    [FORTH_ROT] = &&op_FORTH_ROT,
+    [FORTH_SWAP] = &&op_FORTH_SWAP,
+    [FORTH_CALL] = &&op_FORTH_CALL,
+    [FORTH_JUMP] = &&op_FORTH_JUMP,
+    [FORTH_JZ] = &&op_FORTH_JZ,
+    [FORTH_JNZ] = &&op_FORTH_JNZ,
+    [FORTH_DO] = &&op_FORTH_DO,
+    [FORTH_LOOP] = &&op_FORTH_LOOP,
+    [FORTH_DEPTH] = &&op_FORTH_DEPTH,
+    [FORTH_I] = &&op_FORTH_I,
+    [FORTH_CR] = &&op_FORTH_CR,
+    [FORTH_FULLSTOP] = &&op_FORTH_FULLSTOP,
+    [FORTH_RECURSE] = &&op_FORTH_RECURSE,
+    [FORTH_LESS] = &&op_FORTH_LESS,
+    [FORTH_GREATER] = &&op_FORTH_GREATER,
+    [FORTH_INC] = &&op_FORTH_INC,
+    [FORTH_DEC] = &&op_FORTH_DEC,
+    [FORTH_EQUAL] = &&op_FORTH_EQUAL,
+    [FORTH_PUTSTR] = &&op_FORTH_PUTSTR,
+    [FORTH_BYE] = &&op_FORTH_BYE,
+    [FORTH_SETMEM] = &&op_FORTH_SETMEM,
+    [FORTH_GETMEM] = &&op_FORTH_GETMEM,
+    [FORTH_HERE] = &&op_FORTH_HERE,
+    [FORTH_ALLOT] = &&op_FORTH_ALLOT,
+    [FORTH_EMIT] = &&op_FORTH_EMIT,
+    [FORTH_LOOPPLUS] = &&op_FORTH_LOOPPLUS,
+    [FORTH_BLOCK] = &&op_FORTH_BLOCK,
+    [FORTH_BUFFER] = &&op_FORTH_BUFFER,
+    [FORTH_UPDATE] = &&op_FORTH_UPDATE,
+    [FORTH_FLUSH] = &&op_FORTH_FLUSH,
+    [FORTH_CGETMEM] = &&op_FORTH_CGETMEM,
+    [FORTH_CSETMEM] = &&op_FORTH_CSETMEM,
+    [FORTH_MOVE] = &&op_FORTH_MOVE,
+    [FORTH_CMOVE] = &&op_FORTH_CMOVE,
+    [FORTH_FILL] = &&op_FORTH_FILL,
+    [FORTH_SUM] = &&op_FORTH_SUM,
+    [FORTH_DOT] = &&op_FORTH_DOT,
+    [FORTH_VADD] = &&op_FORTH_VADD,
+    [FORTH_VMUL] = &&op_FORTH_VMUL,
+    [FORTH_VMIN] = &&op_FORTH_VMIN,
+    [FORTH_VMAX] = &&op_FORTH_VMAX,
+    [FORTH_COUNTEQ] = &&op_FORTH_COUNTEQ,
+    [FORTH_SORT] = &&op_FORTH_SORT,
+    [FORTH_BSEARCH] = &&op_FORTH_BSEARCH,
+    [FORTH_TABLENEW] = &&op_FORTH_TABLENEW,
+    [FORTH_TABLEPUT] = &&op_FORTH_TABLEPUT,
+    [FORTH_TABLEGET] = &&op_FORTH_TABLEGET,
+    [FORTH_TASK] = &&op_FORTH_TASK,
+    [FORTH_START] = &&op_FORTH_START,
+    [FORTH_PAUSE] = &&op_FORTH_PAUSE,
+    [FORTH_STOP] = &&op_FORTH_STOP,
+    [FORTH_ADDLIT] = &&op_FORTH_ADDLIT,
+    [FORTH_MULLIT] = &&op_FORTH_MULLIT,
+    [FORTH_DIVLIT] = &&op_FORTH_DIVLIT,
+    [FORTH_MODLIT] = &&op_FORTH_MODLIT,
+    [FORTH_EQUALLIT] = &&op_FORTH_EQUALLIT,
+    [FORTH_LESSLIT] = &&op_FORTH_LESSLIT,
+    [FORTH_GREATERLIT] = &&op_FORTH_GREATERLIT,
+    [FORTH_SQUARE] = &&op_FORTH_SQUARE,
+    [FORTH_NIP] = &&op_FORTH_NIP,
+    [FORTH_2DUP] = &&op_FORTH_2DUP,
+    [FORTH_TAILCALL] = &&op_FORTH_TAILCALL,
+  };
+
+  FORTH_NEXT;
+  {
+#else
+  for(;;) {
+    if(pc >= size)
+      goto ret;
+
+    PROFILE_OP();
+    switch(program[pc++]) {
+#endif
+    FORTH_OP(FORTH_PUSH):
+      n1 = program[pc++];
+      PUSH(n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_PLUS):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2+n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_MUL):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2*n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_MINUS):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2-n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DIV):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2/n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_MOD):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2%n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DUP):
+      n1 = POP();
+      PUSH(n1);
+      PUSH(n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_SWAP):
+      if(HAS(2)) {
+        n1 = fth->stack[SP-1];
+        fth->stack[SP-1] = fth->stack[SP-2];
+        fth->stack[SP-2] = n1;
+      }
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DROP):
+      (void)POP();
+      FORTH_NEXT;
+    FORTH_OP(FORTH_ROT):
+      if(HAS(3)) {
+        n1 = fth->stack[SP-1];
+        fth->stack[SP-1] = fth->stack[SP-3];
+        fth->stack[SP-3] = fth->stack[SP-2];
+        fth->stack[SP-2] = n1;
+      }
+      FORTH_NEXT;
+    FORTH_OP(FORTH_OVER):
+      if(HAS(2)) {
+        n1 = fth->stack[SP-2];
+        PUSH(n1);
+      }
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DEPTH):
+      n1 = SP;
+      PUSH(n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_FULLSTOP):
+      forth_putNumber(fth, POP());
+      FORTH_NEXT;
+    FORTH_OP(FORTH_CR):
+      forth_putChar(fth, '\n');
+      FORTH_NEXT;
+    FORTH_OP(FORTH_CALL):
+      /* native code runs the callee to completion without frames */
+      n1 = program[pc];
+      if(NATIVE(&fth->dict.words[n1])) {
+        SYNC();
+        fth->dict.words[n1].jit(fth);
+        LOAD();
+        if(fth->quit)
+          goto done;
+        pc++;
+        FORTH_NEXT;
+      }
+      if(fth->rsp >= fth->rstack_size)
+        goto overflow;
+      fth->rstack[fth->rsp].word = w;
+      fth->rstack[fth->rsp++].pc = pc+1;
+      w = &fth->dict.words[program[pc]];
+      program = w->program;
+      size = w->size;
+      pc = 0;
+      PROFILE_ENTER(w);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_TAILCALL):
+      n1 = program[pc];
+      if(NATIVE(&fth->dict.words[n1])) {
+        SYNC();
+        fth->dict.words[n1].jit(fth);
+        LOAD();
+        if(fth->quit)
+          goto done;
+        goto ret;
+      }
+      PROFILE_LEAVE();
+      w = &fth->dict.words[n1];
+      program = w->program;
+      size = w->size;
+      pc = 0;
+      PROFILE_ENTER(w);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_RECURSE):
+      if(fth->rsp >= fth->rstack_size)
+        goto overflow;
+      fth->rstack[fth->rsp].word = w;
+      fth->rstack[fth->rsp++].pc = pc;
+      pc = 0;
+      PROFILE_ENTER(w);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_JUMP):
+      pc = program[pc];
+      FORTH_NEXT;
+    FORTH_OP(FORTH_JZ):
+      if(!POP())
+        pc = program[pc];
+      else
+        pc++;
+      FORTH_NEXT;
+    FORTH_OP(FORTH_JNZ):
+      if(POP())
+        pc = program[pc];
+      else
+        pc++;
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DO):
+      n1 = POP();
+      n2 = POP();
+#if FORTH_CHECKED
+      if(fth->lsp+2 > fth->lstack_size)
+        goto loverflow;
+#endif
+      fth->lstack[fth->lsp++] = n1;
+      fth->lstack[fth->lsp++] = n2;
+      FORTH_NEXT;
+    FORTH_OP(FORTH_LOOPPLUS):
+      n1 = POP();
+      fth->lstack[fth->lsp-2] += n1 - 1;
+    FORTH_OP(FORTH_LOOP):
+      n1 = fth->lstack[fth->lsp-1];
+      fth->lstack[fth->lsp-2]++;
+      n2 = fth->lstack[fth->lsp-2];
+      if(n2 < n1)
+        pc = program[pc];
+      else {
+        fth->lsp -= 2;
+        pc++;
+      }
+      FORTH_NEXT;
+    FORTH_OP(FORTH_I):
+      n1 = fth->lstack[fth->lsp-2];
+      PUSH(n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_INC):
+      if(HAS(1))
+        fth->stack[SP-1]++;
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DEC):
+      if(HAS(1))
+        fth->stack[SP-1]--;
+      FORTH_NEXT;
+    FORTH_OP(FORTH_GREATER):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2 > n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_LESS):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2 < n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_EQUAL):
+      n1 = POP();
+      n2 = POP();
+      PUSH(n2 == n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_PUTSTR):
+      forth_putString(fth, w->strings[program[pc++]]);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_BYE):
+      fth->quit = true;
+      forth_flushOutput(fth);
+      goto done;
+    FORTH_OP(FORTH_HERE):
+      PUSH(fth->here);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_ALLOT):
+      n1 = POP();
+      forth_allot(fth, n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_SETMEM):
+      n1 = POP();
+      n2 = POP();
+      forth_store(fth, n1, n2);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_GETMEM):
+      n1 = POP();
+      PUSH(forth_fetch(fth, n1));
+      FORTH_NEXT;
+    FORTH_OP(FORTH_CSETMEM):
+      n1 = POP();
+      n2 = POP();
+      fth->memory[n1] = n2;
+      FORTH_NEXT;
+    FORTH_OP(FORTH_CGETMEM):
+      n1 = POP();
+      PUSH(fth->memory[n1]);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_MOVE):
+      n1 = POP();
+      n2 = POP();
+      forth_move(fth, POP(), n2, n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_CMOVE):
+      n1 = POP();
+      n2 = POP();
+      forth_cmove(fth, POP(), n2, n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_FILL):
+      n1 = POP();
+      n2 = POP();
+      forth_fill(fth, POP(), n2, n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_SUM):
+      n1 = POP();
+      n2 = POP();
+      PUSH(forth_sum(fth, n2, n1));
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DOT):
+      n1 = POP();
+      n2 = POP();
+      n2 = forth_dot(fth, POP(), n2, n1);
+      PUSH(n2);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_VADD):
+    FORTH_OP(FORTH_VMUL):
+      n1 = POP();
+      n2 = POP();
+      {
+        int b = POP();
+        forth_map(fth, POP(), b, n2, n1, program[pc-1] == FORTH_VMUL);
+      }
+      FORTH_NEXT;
+    FORTH_OP(FORTH_VMIN):
+    FORTH_OP(FORTH_VMAX):
+      n1 = POP();
+      n2 = POP();
+      PUSH(forth_extreme(fth, n2, n1, program[pc-1] == FORTH_VMAX));
+      FORTH_NEXT;
+    FORTH_OP(FORTH_COUNTEQ):
+      n1 = POP();
+      n2 = POP();
+      n2 = forth_countEqual(fth, POP(), n2, n1);
+      PUSH(n2);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_SORT):
+      n1 = POP();
+      n2 = POP();
+      forth_sort(fth, n2, n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_BSEARCH):
+      n1 = POP();
+      n2 = POP();
+      n2 = forth_bsearch(fth, POP(), n2, n1);
+      PUSH(n2);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_TABLENEW):
+      n1 = POP();
+      PUSH(forth_tableNew(fth, n1));
+      FORTH_NEXT;
+    FORTH_OP(FORTH_TABLEPUT):
+      n1 = POP();
+      n2 = POP();
+      forth_tablePut(fth, n1, n2, POP());
+      FORTH_NEXT;
+    FORTH_OP(FORTH_TABLEGET):
+      n1 = POP();
+      n2 = POP();
+      n2 = forth_tableFind(fth, n1, n2);
+      PUSH(n2 == -1 ? 0 : forth_fetch(fth, n2));
+      PUSH(n2 != -1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_TASK):
+      n1 = POP();
+      PUSH(forth_newTask(fth, n1));
+      FORTH_NEXT;
+    FORTH_OP(FORTH_START):
+      n1 = POP();
+      n2 = POP();
+      forth_startTask(fth, n1, n2);
+      FORTH_NEXT;
+    /* the interpreter's own code gives every task a turn, a task leaves
+     * the engine with its place on its return stack to be resumed from */
+    FORTH_OP(FORTH_PAUSE):
+      SYNC();
+      if(!fth->task) {
+        forth_pause(fth);
+        LOAD();
+        if(fth->quit)
+          goto done;
+        FORTH_NEXT;
+      }
+      if(fth->rsp >= fth->rstack_size)
+        goto overflow;
+      fth->rstack[fth->rsp].word = w;
+      fth->rstack[fth->rsp++].pc = pc;
+#if FORTH_PROFILE
+      forth_profileUnwind(fth, pbase);
+#endif
+      return;
+    FORTH_OP(FORTH_STOP):
+      n1 = POP();
+      if(forth_stopTask(fth, n1))
+        goto done;
+      FORTH_NEXT;
+    FORTH_OP(FORTH_EMIT):
+      n1 = POP();
+      forth_putChar(fth, n1);
+      FORTH_NEXT;
+    /* the file is mapped, so a buffer never has to be read in first */
+    FORTH_OP(FORTH_BLOCK):
+    FORTH_OP(FORTH_BUFFER):
+      n1 = POP();
+      PUSH(forth_block(fth, n1));
+      FORTH_NEXT;
+    FORTH_OP(FORTH_UPDATE):
+      forth_update(fth);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_FLUSH):
+      forth_flush(fth);
+      forth_flushOutput(fth);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_ADDLIT):
+      n1 = program[pc++];
+      n2 = POP();
+      PUSH(n2+n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_MULLIT):
+      n1 = program[pc++];
+      n2 = POP();
+      PUSH(n2*n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_DIVLIT):
+      n1 = program[pc++];
+      n2 = POP();
+      PUSH(n2/n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_MODLIT):
+      n1 = program[pc++];
+      n2 = POP();
+      PUSH(n2%n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_EQUALLIT):
+      n1 = program[pc++];
+      n2 = POP();
+      PUSH(n2 == n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_LESSLIT):
+      n1 = program[pc++];
+      n2 = POP();
+      PUSH(n2 < n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_GREATERLIT):
+      n1 = program[pc++];
+      n2 = POP();
+      PUSH(n2 > n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_SQUARE):
+      n1 = POP();
+      PUSH(n1*n1);
+      FORTH_NEXT;
+    FORTH_OP(FORTH_NIP):
+      if(HAS(2)) {
+        fth->stack[SP-2] = fth->stack[SP-1];
+        (void)POP();
+      }
+      else
+        (void)POP();
+      FORTH_NEXT;
+    FORTH_OP(FORTH_2DUP):
+      if(HAS(2)) {
+        n1 = fth->stack[SP-2];
+        n2 = fth->stack[SP-1];
+        PUSH(n1);
+        PUSH(n2);
+      }
+      else
+        HAS(2);
+      FORTH_NEXT;
+#ifndef FORTH_THREADED
+    }
+    continue;
+#endif
+
+  ret:
+    if(fth->rsp == base)
+      goto done;
+    PROFILE_LEAVE();
+    fth->rsp--;
+    w = fth->rstack[fth->rsp].word;
+    program = w->program;
+    size = w->size;
+    pc = fth->rstack[fth->rsp].pc;
+#ifdef FORTH_THREADED
+    FORTH_NEXT;
+#endif
+  }
+
+overflow:
+  forth_putString(fth, "return stack overflow !\n");
+  fth->lsp = lbase;
+  goto done;
+
+#if FORTH_CHECKED
+loverflow:
+  forth_putString(fth, "loop stack overflow !\n");
+  fth->lsp = lbase;
+#endif
+
+done:
+  fth->rsp = base;
+  SYNC();
+#if FORTH_PROFILE
+  forth_profileUnwind(fth, pbase);
+#endif
+}
+
+#undef SP
+#undef POP
+#undef PUSH
+#undef HAS
+#undef SYNC
+#undef LOAD
+#undef FITS
+#undef PROFILE_OP
+#undef PROFILE_ENTER
+#undef PROFILE_LEAVE
+#undef NATIVE
@@ -2,8 +2,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 #include "forth.h"
 
 const char *forth_compileOnly[] = {
@@ -23,20 +25,6 @@ void forth_uppercase(char *s) {
       *c = *c - 'a' + 'A';
 }
 
-int forth_chars2int(char *c) {
-  int n = c[0] << 24;
-  n |= c[1] << 16;
-  n |= c[2] << 8;
-  n |= c[3];
-}
-
-void forth_int2chars(int n, char *c) {
-  c[0] = n>>24;
-  c[1] = n>>16;
-  c[2] = n>>8;
-  c[3] = n;
-}
-
 bool forth_isnum(char *s, int *n) {
   if(!strlen(s))
     return false;
@@ -65,31 +53,163 @@ void forth_initWord(ForthWord *w, char *identifier) {
   forth_uppercase(w->identifier);
   w->program = 0;
   w->size = 0;
+  w->cap = 0;
   w->strings = 0;
   w->num_strings = 0;
+  w->source = 0;
+  w->source_size = 0;
+  w->safe = false;
+  w->jit = 0;
+  w->jit_size = 0;
+  w->borrowed = false;
 }
 
 void forth_freeWord(ForthWord w) {
+  forth_jitFree(&w);
+  if(w.borrowed)
+    return;
+
   free(w.identifier);
   if(w.program)
     free(w.program);
-  if(w.strings)
+  if(w.strings) {
+    for(int i = 0; i < w.num_strings; i++)
+      free(w.strings[i]);
     free(w.strings);
+  }
+  if(w.source)
+    free(w.source);
+}
+
+/* words are compiled on the heap, then forth_storeWord copies each one
+ * into a single block of the instance arena, which grows by chunks of
+ * twice the size each time and is only freed with the instance. A word
+ * that has to change again gets heap copies back from forth_ownWord */
+
+static void *forth_arenaAlloc(ForthChunk **arena, long n) {
+  n = (n + 7) & ~7L;
+  ForthChunk *c = *arena;
+  if(!c || c->used + n > c->size) {
+    long size = c ? c->size*2 : 16384;
+    while(size < n)
+      size *= 2;
+    c = malloc(sizeof(ForthChunk) + size);
+    c->next = *arena;
+    c->size = size;
+    c->used = 0;
+    *arena = c;
+  }
+
+  void *p = (char*)(c+1) + c->used;
+  c->used += n;
+  return p;
 }
 
-void forth_addInstruction(ForthWord *w, char ins) {
-  w->program = realloc(w->program, ++(w->size));
-  w->program[w->size-1] = ins;
+void forth_freeArena(ForthChunk *arena) {
+  while(arena) {
+    ForthChunk *next = arena->next;
+    free(arena);
+    arena = next;
+  }
+}
+
+/* points w at copies of its body in a single block of arena */
+void forth_copyWord(ForthChunk **arena, ForthWord *w) {
+  long size = sizeof(int)*(w->size + w->source_size)
+    + sizeof(char*)*w->num_strings + strlen(w->identifier)+1;
+  for(int i = 0; i < w->num_strings; i++)
+    size += strlen(w->strings[i])+1;
+
+  /* pointers, then cells, then characters keeps everything aligned */
+  char *at = forth_arenaAlloc(arena, size);
+  ForthWord heap = *w;
+  if(heap.strings) {
+    w->strings = (char**)at;
+    at += sizeof(char*)*w->num_strings;
+  }
+  w->program = memcpy(at, heap.program, sizeof(int)*w->size);
+  at += sizeof(int)*w->size;
+  if(heap.source) {
+    w->source = memcpy(at, heap.source, sizeof(int)*w->source_size);
+    at += sizeof(int)*w->source_size;
+  }
+  w->identifier = strcpy(at, heap.identifier);
+  at += strlen(at)+1;
+  for(int i = 0; i < w->num_strings; i++) {
+    w->strings[i] = strcpy(at, heap.strings[i]);
+    at += strlen(at)+1;
+  }
+
+  w->cap = w->size;
+  w->borrowed = true;
+}
+
+void forth_storeWord(ForthInstance *fth, ForthWord *w) {
+  if(w->borrowed)
+    return;
+
+  ForthWord heap = *w;
+  forth_copyWord(&fth->arena, w);
+  heap.jit = 0;
+  forth_freeWord(heap);
+}
+
+/* gives a word its own copies of everything, before it is changed in a
+ * way that would realloc or free them */
+void forth_ownWord(ForthWord *w) {
+  if(!w->borrowed)
+    return;
+
+  char *identifier = w->identifier;
+  w->identifier = malloc(strlen(identifier)+1);
+  strcpy(w->identifier, identifier);
+
+  if(w->program) {
+    int *program = w->program;
+    w->program = malloc(sizeof(int)*(w->size ? w->size : 1));
+    memcpy(w->program, program, sizeof(int)*w->size);
+  }
+  w->cap = w->size;
+  if(w->source) {
+    int *source = w->source;
+    w->source = malloc(sizeof(int)*(w->source_size ? w->source_size : 1));
+    memcpy(w->source, source, sizeof(int)*w->source_size);
+  }
+  if(w->strings) {
+    char **strings = w->strings;
+    w->strings = malloc(sizeof(char*)*w->num_strings);
+    for(int i = 0; i < w->num_strings; i++) {
+      w->strings[i] = malloc(strlen(strings[i])+1);
+      strcpy(w->strings[i], strings[i]);
+    }
+  }
+
+  w->borrowed = false;
+}
+
+/* programs are arrays of native cells, an opcode takes one cell and its
+ * operand (if any) the next, so the engine never has to decode bytes */
+
+static void forth_reserve(ForthWord *w, int n) {
+  if(w->size + n <= w->cap)
+    return;
+  w->cap = w->cap ? w->cap*2 : 16;
+  while(w->cap < w->size + n)
+    w->cap *= 2;
+  w->program = realloc(w->program, sizeof(int)*w->cap);
+}
+
+void forth_addInstruction(ForthWord *w, int ins) {
+  forth_reserve(w, 1);
+  w->program[w->size++] = ins;
 }
 
 void forth_addInteger(ForthWord *w, int n) {
-  w->size += 4;
-  w->program = realloc(w->program, w->size);
-  forth_int2chars(n, w->program+w->size-4);
+  forth_addInstruction(w, n);
 }
 
 void forth_concatWord(ForthWord *w, ForthWord w2) {
-  w->program = realloc(w->program, w->size+w2.size);
+  forth_reserve(w, w2.size);
   for(int i = 0; i < w2.size; i++)
     w->program[w->size+i] = w2.program[i];
   w->size += w2.size;
@@ -101,10 +221,735 @@ void forth_addString(ForthWord *w, char *s) {
   strcpy(w->strings[w->num_strings-1], s);
 }
 
+int forth_opSize(int op) {
+  switch(op) {
+  case FORTH_PUSH:
+  case FORTH_CALL:
+  case FORTH_TAILCALL:
+  case FORTH_JUMP:
+  case FORTH_JZ:
+  case FORTH_JNZ:
+  case FORTH_LOOP:
+  case FORTH_LOOPPLUS:
+  case FORTH_PUTSTR:
+  case FORTH_ADDLIT:
+  case FORTH_MULLIT:
+  case FORTH_DIVLIT:
+  case FORTH_MODLIT:
+  case FORTH_EQUALLIT:
+  case FORTH_LESSLIT:
+  case FORTH_GREATERLIT:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+bool forth_isJump(int op) {
+  return op == FORTH_JUMP || op == FORTH_JZ || op == FORTH_JNZ
+    || op == FORTH_LOOP || op == FORTH_LOOPPLUS;
+}
+
+/* stack effect verification - the word is walked along every path with
+ * the data and loop stack depths relative to entry, and is safe if every
+ * path agrees on them wherever they meet */
+
+typedef struct forthVerify {
+  ForthWord *w;
+  int *depth, *ldepth;
+  int *work;
+  int num_work;
+  int end;
+} ForthVerify;
+
+static bool forth_reach(ForthVerify *v, int pc, int d, int l) {
+  if(pc < 0 || pc > v->w->size)
+    return false;
+
+  if(pc == v->w->size) {
+    if(v->end == FORTH_UNKNOWN)
+      v->end = d;
+    return v->end == d && l == 0;
+  }
+
+  if(v->depth[pc] == FORTH_UNKNOWN) {
+    v->depth[pc] = d;
+    v->ldepth[pc] = l;
+    v->work[v->num_work++] = pc;
+    return true;
+  }
+  return v->depth[pc] == d && v->ldepth[pc] == l;
+}
+
+/* verifies w, leaving the depths on entry to each instruction in depth
+ * and ldepth (w->size+1 cells each), FORTH_UNKNOWN where unreachable */
+void forth_verifyDepths(ForthInstance *fth, ForthWord *w,
+    int *depth, int *ldepth)
+{
+  ForthVerify v;
+  v.w = w;
+  v.depth = depth;
+  v.ldepth = ldepth;
+  v.work = malloc(sizeof(int)*(w->size+1));
+  v.num_work = 0;
+  v.end = FORTH_UNKNOWN;
+  for(int i = 0; i < w->size; i++)
+    v.depth[i] = FORTH_UNKNOWN;
+
+  int need = 0, peak = 0, lpeak = 0;
+  bool ok = forth_reach(&v, 0, 0, 0);
+
+  while(ok && v.num_work) {
+    int pc = v.work[--v.num_work];
+    int d = v.depth[pc], l = v.ldepth[pc];
+    int op = w->program[pc];
+    int next = pc + forth_opSize(op);
+    int pops = 0, pushes = 0;
+
+    switch(op) {
+    case FORTH_PUSH:
+    case FORTH_DEPTH:
+    case FORTH_HERE:
+      pushes = 1; break;
+    case FORTH_I:
+      ok = l >= 2;
+      pushes = 1; break;
+    case FORTH_DROP:
+    case FORTH_FULLSTOP:
+    case FORTH_ALLOT:
+    case FORTH_EMIT:
+    case FORTH_JZ:
+    case FORTH_JNZ:
+    case FORTH_LOOPPLUS:
+      pops = 1; break;
+    case FORTH_INC:
+    case FORTH_DEC:
+    case FORTH_GETMEM:
+    case FORTH_CGETMEM:
+    case FORTH_BLOCK:
+    case FORTH_BUFFER:
+    case FORTH_ADDLIT:
+    case FORTH_MULLIT:
+    case FORTH_DIVLIT:
+    case FORTH_MODLIT:
+    case FORTH_EQUALLIT:
+    case FORTH_LESSLIT:
+    case FORTH_GREATERLIT:
+    case FORTH_SQUARE:
+    case FORTH_TABLENEW:
+    case FORTH_TASK:
+      pops = 1; pushes = 1; break;
+    case FORTH_PLUS:
+    case FORTH_MINUS:
+    case FORTH_DIV:
+    case FORTH_MUL:
+    case FORTH_MOD:
+    case FORTH_LESS:
+    case FORTH_GREATER:
+    case FORTH_EQUAL:
+      pops = 2; pushes = 1; break;
+    case FORTH_SWAP:
+      pops = 2; pushes = 2; break;
+    case FORTH_NIP:
+      pops = 2; pushes = 1; break;
+    case FORTH_2DUP:
+      pops = 2; pushes = 4; break;
+    case FORTH_DUP:
+      pops = 1; pushes = 2; break;
+    case FORTH_OVER:
+      pops = 2; pushes = 3; break;
+    case FORTH_ROT:
+      pops = 3; pushes = 3; break;
+    case FORTH_DO:
+    case FORTH_SETMEM:
+    case FORTH_CSETMEM:
+      pops = 2; break;
+    case FORTH_MOVE:
+    case FORTH_CMOVE:
+    case FORTH_FILL:
+      pops = 3; break;
+    case FORTH_SUM:
+    case FORTH_VMIN:
+    case FORTH_VMAX:
+      pops = 2; pushes = 1; break;
+    case FORTH_DOT:
+    case FORTH_COUNTEQ:
+    case FORTH_BSEARCH:
+      pops = 3; pushes = 1; break;
+    case FORTH_SORT:
+      pops = 2; break;
+    case FORTH_TABLEPUT:
+      pops = 3; break;
+    case FORTH_TABLEGET:
+      pops = 2; pushes = 2; break;
+    case FORTH_START:
+      pops = 2; break;
+    case FORTH_VADD:
+    case FORTH_VMUL:
+      pops = 4; break;
+    case FORTH_CALL:
+    case FORTH_TAILCALL: {
+      ForthWord *callee = &fth->dict.words[w->program[pc+1]];
+      ok = callee->safe;
+      pops = callee->need;
+      pushes = callee->need + callee->effect;
+      if(d + callee->peak > peak)
+        peak = d + callee->peak;
+      if(l + callee->lpeak > lpeak)
+        lpeak = l + callee->lpeak;
+      break;
+    }
+    case FORTH_RECURSE:
+    case FORTH_PAUSE:
+    case FORTH_STOP:
+      ok = false; break;
+    }
+    if(!ok)
+      break;
+
+    if(pops - d > need)
+      need = pops - d;
+    d += pushes - pops;
+    if(d > peak)
+      peak = d;
+
+    switch(op) {
+    case FORTH_BYE:
+      break;
+    case FORTH_TAILCALL:
+      ok = forth_reach(&v, w->size, d, l);
+      break;
+    case FORTH_JUMP:
+      ok = forth_reach(&v, w->program[pc+1], d, l);
+      break;
+    case FORTH_JZ:
+    case FORTH_JNZ:
+      ok = forth_reach(&v, w->program[pc+1], d, l)
+        && forth_reach(&v, next, d, l);
+      break;
+    case FORTH_DO:
+      if(l+2 > lpeak)
+        lpeak = l+2;
+      ok = forth_reach(&v, next, d, l+2);
+      break;
+    case FORTH_LOOP:
+    case FORTH_LOOPPLUS:
+      ok = l >= 2 && forth_reach(&v, w->program[pc+1], d, l)
+        && forth_reach(&v, next, d, l-2);
+      break;
+    default:
+      ok = forth_reach(&v, next, d, l);
+      break;
+    }
+  }
+
+  w->safe = ok;
+  w->need = need;
+  w->effect = v.end == FORTH_UNKNOWN ? 0 : v.end;
+  w->peak = peak;
+  w->lpeak = lpeak;
+
+  free(v.work);
+}
+
+void forth_verifyWord(ForthInstance *fth, ForthWord *w) {
+  int *depth = malloc(sizeof(int)*(w->size+1));
+  int *ldepth = malloc(sizeof(int)*(w->size+1));
+  forth_verifyDepths(fth, w, depth, ldepth);
+  free(depth);
+  free(ldepth);
+}
+
+/* redefining a word in place changes the effect its callers were proven
+ * with, so the words marked in set are verified again until nothing
+ * changes */
+void forth_reverify(ForthInstance *fth, const char *set) {
+  for(int i = 0; i < fth->dict.size; i++)
+    if(set[i])
+      fth->dict.words[i].safe = false;
+
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(int i = 0; i < fth->dict.size; i++)
+      if(set[i] && !fth->dict.words[i].safe) {
+        forth_verifyWord(fth, &fth->dict.words[i]);
+        changed |= fth->dict.words[i].safe;
+      }
+  }
+
+  /* native code was compiled from the old programs and proofs */
+  for(int i = 0; i < fth->dict.size; i++)
+    if(set[i])
+      forth_jitWord(fth, i);
+}
+
+/* compiled code is rewritten as a list of instructions whose jump
+ * operands are instruction indices, so passes can drop and replace
+ * instructions without tracking program offsets */
+
+ForthIns *forth_decode(ForthWord *w, int *num) {
+  int *at = malloc(sizeof(int)*(w->size+1));
+  int n = 0;
+  for(int pc = 0; pc < w->size; pc += forth_opSize(w->program[pc]))
+    at[pc] = n++;
+  at[w->size] = n;
+
+  ForthIns *ins = malloc(sizeof(ForthIns)*(n+1));
+  n = 0;
+  for(int pc = 0; pc < w->size; pc += forth_opSize(w->program[pc])) {
+    ins[n].op = w->program[pc];
+    ins[n].arg = forth_opSize(ins[n].op) > 1 ? w->program[pc+1] : 0;
+    ins[n].target = false;
+    ins[n].dead = false;
+    n++;
+  }
+  ins[n].target = false;
+  for(int i = 0; i < n; i++)
+    if(forth_isJump(ins[i].op)) {
+      ins[i].arg = at[ins[i].arg];
+      ins[ins[i].arg].target = true;
+    }
+
+  free(at);
+  *num = n;
+  return ins;
+}
+
+/* replaces the program of w with the live instructions of ins, a jump to
+ * a dead instruction lands on the next live one */
+void forth_encode(ForthWord *w, ForthIns *ins, int num) {
+  int *at = malloc(sizeof(int)*(num+1));
+  int size = 0;
+  for(int i = 0; i < num; i++) {
+    at[i] = size;
+    if(!ins[i].dead)
+      size += forth_opSize(ins[i].op);
+  }
+  at[num] = size;
+
+  forth_ownWord(w);
+  w->program = realloc(w->program, sizeof(int)*(size ? size : 1));
+  w->cap = size;
+  w->size = 0;
+  for(int i = 0; i < num; i++) {
+    if(ins[i].dead)
+      continue;
+    w->program[w->size++] = ins[i].op;
+    if(forth_opSize(ins[i].op) > 1)
+      w->program[w->size++] = forth_isJump(ins[i].op) ?
+        at[ins[i].arg] : ins[i].arg;
+  }
+
+  free(at);
+}
+
+/* peephole optimizer - folds constant arithmetic and fuses common short
+ * sequences into superinstructions. Each superinstruction pops and
+ * pushes exactly like the sequence it replaces, so even underflow
+ * behaves the same, and nothing is fused across a jump target */
+
+static bool forth_fold(int op, int a, int b, int *r) {
+  unsigned int ua = a, ub = b;
+  switch(op) {
+  case FORTH_PLUS: case FORTH_ADDLIT:
+    *r = ua + ub; return true;
+  case FORTH_MINUS:
+    *r = ua - ub; return true;
+  case FORTH_MUL: case FORTH_MULLIT:
+    *r = ua * ub; return true;
+  case FORTH_DIV: case FORTH_DIVLIT:
+    if(b == 0 || (a == INT_MIN && b == -1))
+      return false;
+    *r = a / b; return true;
+  case FORTH_MOD: case FORTH_MODLIT:
+    if(b == 0 || (a == INT_MIN && b == -1))
+      return false;
+    *r = a % b; return true;
+  case FORTH_EQUAL: case FORTH_EQUALLIT:
+    *r = a == b; return true;
+  case FORTH_LESS: case FORTH_LESSLIT:
+    *r = a < b; return true;
+  case FORTH_GREATER: case FORTH_GREATERLIT:
+    *r = a > b; return true;
+  default:
+    return false;
+  }
+}
+
+static int forth_litOp(int op) {
+  switch(op) {
+  case FORTH_PLUS: return FORTH_ADDLIT;
+  case FORTH_MINUS: return FORTH_ADDLIT;
+  case FORTH_MUL: return FORTH_MULLIT;
+  case FORTH_DIV: return FORTH_DIVLIT;
+  case FORTH_MOD: return FORTH_MODLIT;
+  case FORTH_EQUAL: return FORTH_EQUALLIT;
+  case FORTH_LESS: return FORTH_LESSLIT;
+  case FORTH_GREATER: return FORTH_GREATERLIT;
+  default: return -1;
+  }
+}
+
+static int forth_nextLive(ForthIns *ins, int num, int i) {
+  for(i++; i < num && ins[i].dead; i++);
+  return i;
+}
+
+static bool forth_peephole(ForthIns *ins, int num) {
+  bool changed = false;
+
+  for(int i = 0; i < num; i++) {
+    if(ins[i].dead)
+      continue;
+    int j = forth_nextLive(ins, num, i);
+    if(j >= num || ins[j].target)
+      continue;
+    int k = forth_nextLive(ins, num, j);
+    bool triple = k < num && !ins[k].target;
+
+    ForthIns *a = &ins[i], *b = &ins[j], *c = triple ? &ins[k] : 0;
+    int r;
+
+    /* only a plain binary op takes both pushes, a superinstruction
+     * brings its own operand */
+    if(c && a->op == FORTH_PUSH && b->op == FORTH_PUSH
+        && forth_litOp(c->op) != -1
+        && forth_fold(c->op, a->arg, b->arg, &r)) {
+      a->arg = r;
+      b->dead = c->dead = true;
+    }
+    else if(a->op == FORTH_PUSH && forth_opSize(b->op) > 1
+        && forth_fold(b->op, a->arg, b->arg, &r)) {
+      a->arg = r;
+      b->dead = true;
+    }
+    else if((a->op == FORTH_PUSH || a->op == FORTH_ADDLIT)
+        && (b->op == FORTH_INC || b->op == FORTH_DEC)) {
+      forth_fold(FORTH_PLUS, a->arg, b->op == FORTH_INC ? 1 : -1, &a->arg);
+      b->dead = true;
+    }
+    else if(a->op == FORTH_PUSH && forth_litOp(b->op) != -1) {
+      if(b->op == FORTH_MINUS && a->arg == INT_MIN)
+        continue;
+      a->op = forth_litOp(b->op);
+      if(b->op == FORTH_MINUS)
+        a->arg = -a->arg;
+      b->dead = true;
+    }
+    else if((a->op == FORTH_ADDLIT || a->op == FORTH_MULLIT)
+        && b->op == a->op) {
+      forth_fold(a->op, a->arg, b->arg, &a->arg);
+      b->dead = true;
+    }
+    else if(a->op == FORTH_DUP && b->op == FORTH_MUL) {
+      a->op = FORTH_SQUARE;
+      b->dead = true;
+    }
+    else if(a->op == FORTH_SWAP && b->op == FORTH_DROP) {
+      a->op = FORTH_NIP;
+      b->dead = true;
+    }
+    else if(a->op == FORTH_OVER && b->op == FORTH_OVER) {
+      a->op = FORTH_2DUP;
+      b->dead = true;
+    }
+    else
+      continue;
+
+    changed = true;
+    i--;
+  }
+
+  return changed;
+}
+
+/* tail calls - a RECURSE or call after which the word can only end,
+ * possibly through a chain of jumps, reuses the current frame instead of
+ * pushing one. RECURSE becomes a jump back to the start, a call becomes
+ * a tail call that replaces the running word with its callee */
+
+static int forth_liveFrom(ForthIns *ins, int num, int i) {
+  for(; i < num && ins[i].dead; i++);
+  return i;
+}
+
+static bool forth_tailCalls(ForthIns *ins, int num) {
+  bool changed = false;
+
+  for(int i = 0; i < num; i++) {
+    if(ins[i].dead || (ins[i].op != FORTH_CALL && ins[i].op != FORTH_RECURSE))
+      continue;
+
+    int j = forth_liveFrom(ins, num, i+1);
+    for(int hops = 0; j < num && ins[j].op == FORTH_JUMP && hops < num; hops++)
+      j = forth_liveFrom(ins, num, ins[j].arg);
+    if(j < num)
+      continue;
+
+    if(ins[i].op == FORTH_RECURSE) {
+      ins[i].op = FORTH_JUMP;
+      ins[i].arg = 0;
+      ins[0].target = true;
+    }
+    else
+      ins[i].op = FORTH_TAILCALL;
+    changed = true;
+  }
+
+  return changed;
+}
+
+void forth_optimizeWord(ForthWord *w) {
+  int num;
+  ForthIns *ins = forth_decode(w, &num);
+  bool changed = forth_peephole(ins, num);
+  changed |= forth_tailCalls(ins, num);
+  if(changed)
+    forth_encode(w, ins, num);
+  free(ins);
+}
+
+/* inlining - calls to short user words are replaced by a copy of the
+ * callee's program. A word that inlined anything keeps the program it was
+ * compiled to as its source, so when a callee is redefined its callers
+ * can be derived again instead of running a stale copy */
+
+static bool forth_inlinable(ForthInstance *fth, int index, int self,
+    char *state)
+{
+  ForthWord *w = &fth->dict.words[index];
+  if(!fth->inline_size || index == self || index < fth->dict.lock
+      || w->size > fth->inline_size || w->num_strings)
+    return false;
+  if(state && state[index] != 2)
+    return false;
+
+  for(int pc = 0; pc < w->size; pc += forth_opSize(w->program[pc]))
+    if(w->program[pc] == FORTH_RECURSE)
+      return false;
+  return true;
+}
+
+/* derives the program of w from its source, inlining each call to a word
+ * other than self whose state is done (or to any word if state is 0) */
+void forth_inlineWord(ForthInstance *fth, ForthWord *w, int self,
+    char *state)
+{
+  ForthWord src = *w;
+  if(w->source) {
+    src.program = w->source;
+    src.size = w->source_size;
+  }
+
+  int num;
+  ForthIns *ins = forth_decode(&src, &num);
+  ForthIns **body = malloc(sizeof(ForthIns*)*num);
+  int *at = malloc(sizeof(int)*(num+1));
+
+  int n = 0;
+  bool inlined = false;
+  for(int i = 0; i < num; i++) {
+    at[i] = n;
+    body[i] = 0;
+    if((ins[i].op == FORTH_CALL || ins[i].op == FORTH_TAILCALL)
+        && forth_inlinable(fth, ins[i].arg, self, state)) {
+      int cnum;
+      body[i] = forth_decode(&fth->dict.words[ins[i].arg], &cnum);
+      n += cnum;
+      inlined = true;
+    }
+    else
+      n++;
+  }
+  at[num] = n;
+
+  if(inlined || w->source) {
+    ForthIns *out = malloc(sizeof(ForthIns)*(n+1));
+    for(int i = 0; i < num; i++) {
+      if(!body[i]) {
+        out[at[i]] = ins[i];
+        if(forth_isJump(ins[i].op))
+          out[at[i]].arg = at[ins[i].arg];
+        continue;
+      }
+
+      /* the callee's jumps, including those to its end, move with it,
+       * and its tail calls no longer end the word they are copied into */
+      for(int j = 0; j < at[i+1]-at[i]; j++) {
+        out[at[i]+j] = body[i][j];
+        if(forth_isJump(body[i][j].op))
+          out[at[i]+j].arg += at[i];
+        else if(body[i][j].op == FORTH_TAILCALL)
+          out[at[i]+j].op = FORTH_CALL;
+      }
+      free(body[i]);
+    }
+
+    if(!w->source) {
+      w->source = w->program;
+      w->source_size = w->size;
+      w->program = 0;
+    }
+    forth_encode(w, out, n);
+    free(out);
+  }
+
+  free(body);
+  free(ins);
+  free(at);
+}
+
+/* the user word a call at pc in w's source goes to, -1 if it is not one */
+static int forth_sourceCall(ForthInstance *fth, ForthWord *w, int pc) {
+  int *src = w->source ? w->source : w->program;
+  if((src[pc] != FORTH_CALL && src[pc] != FORTH_TAILCALL)
+      || src[pc+1] < fth->dict.lock)
+    return -1;
+  return src[pc+1];
+}
+
+static int forth_sourceSize(ForthWord *w) {
+  return w->source ? w->source_size : w->size;
+}
+
+static void forth_relinkWord(ForthInstance *fth, int index, char *state) {
+  if(state[index])
+    return;
+  state[index] = 1;
+
+  ForthWord *w = &fth->dict.words[index];
+  int *src = w->source ? w->source : w->program;
+  for(int pc = 0; pc < forth_sourceSize(w); pc += forth_opSize(src[pc]))
+    if(forth_sourceCall(fth, w, pc) != -1)
+      forth_relinkWord(fth, src[pc+1], state);
+
+  forth_inlineWord(fth, w, index, state);
+  forth_optimizeWord(w);
+  state[index] = 2;
+}
+
+/* derives the words marked in set again, callees before their callers,
+ * a call back into a word still being derived is left as a call */
+void forth_relink(ForthInstance *fth, const char *set) {
+  char *state = malloc(fth->dict.size);
+  for(int i = 0; i < fth->dict.size; i++)
+    state[i] = set[i] ? 0 : 2;
+  for(int i = 0; i < fth->dict.size; i++)
+    forth_relinkWord(fth, i, state);
+  free(state);
+}
+
+/* the words a redefinition of index changes, itself and every user word
+ * whose source calls one of them. Each word's callers are listed first,
+ * by[first[c]] to by[first[c+1]-1], so the dictionary is only read once */
+char *forth_callers(ForthInstance *fth, int index) {
+  int size = fth->dict.size;
+  int *first = calloc(size+1, sizeof(int));
+  for(int i = fth->dict.lock; i < size; i++) {
+    ForthWord *w = &fth->dict.words[i];
+    int *src = w->source ? w->source : w->program;
+    for(int pc = 0; pc < forth_sourceSize(w); pc += forth_opSize(src[pc])) {
+      int c = forth_sourceCall(fth, w, pc);
+      if(c != -1)
+        first[c+1]++;
+    }
+  }
+  for(int i = 0; i < size; i++)
+    first[i+1] += first[i];
+
+  int *by = malloc(sizeof(int)*(first[size]+1));
+  int *fill = malloc(sizeof(int)*size);
+  memcpy(fill, first, sizeof(int)*size);
+  for(int i = fth->dict.lock; i < size; i++) {
+    ForthWord *w = &fth->dict.words[i];
+    int *src = w->source ? w->source : w->program;
+    for(int pc = 0; pc < forth_sourceSize(w); pc += forth_opSize(src[pc])) {
+      int c = forth_sourceCall(fth, w, pc);
+      if(c != -1)
+        by[fill[c]++] = i;
+    }
+  }
+
+  /* each word is queued once, when it is first marked */
+  char *set = calloc(size, 1);
+  int *queue = fill;
+  int head = 0, tail = 0;
+  set[index] = 1;
+  queue[tail++] = index;
+  while(head < tail) {
+    int c = queue[head++];
+    for(int j = first[c]; j < first[c+1]; j++)
+      if(!set[by[j]]) {
+        set[by[j]] = 1;
+        queue[tail++] = by[j];
+      }
+  }
+
+  free(fill);
+  free(by);
+  free(first);
+  return set;
+}
+
+/* identifiers are unique in the dictionary, since redefinitions replace
+ * the old word in place, so the index maps each identifier to one slot */
+
+unsigned int forth_hashString(const char *s) {
+  unsigned int h = 2166136261u;
+  for(; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+void forth_hashInsert(ForthInstance *fth, int index) {
+  unsigned int mask = fth->dict.hash_size-1;
+  unsigned int h = forth_hashString(fth->dict.words[index].identifier);
+  while(fth->dict.hash[h & mask] != -1)
+    h++;
+  fth->dict.hash[h & mask] = index;
+}
+
+void forth_hashGrow(ForthInstance *fth) {
+  fth->dict.hash_size = fth->dict.hash_size ? fth->dict.hash_size*2 : 64;
+  fth->dict.hash = realloc(fth->dict.hash, sizeof(int)*fth->dict.hash_size);
+  for(int i = 0; i < fth->dict.hash_size; i++)
+    fth->dict.hash[i] = -1;
+  for(int i = 0; i < fth->dict.size; i++)
+    forth_hashInsert(fth, i);
+}
+
+int forth_findWord(ForthInstance *fth, const char *identifier) {
+  if(!fth->dict.hash_size)
+    return -1;
+
+  unsigned int mask = fth->dict.hash_size-1;
+  for(unsigned int h = forth_hashString(identifier); ; h++) {
+    int i = fth->dict.hash[h & mask];
+    if(i == -1)
+      return -1;
+    if(strcmp(fth->dict.words[i].identifier, identifier) == 0)
+      return i;
+  }
+}
+
 void forth_addWord(ForthInstance *fth, ForthWord w) {
-  fth->dict.words = realloc(fth->dict.words,
-      sizeof(ForthWord)*(++(fth->dict.size)));
-  fth->dict.words[fth->dict.size-1] = w;
+  forth_thaw(fth);
+  forth_verifyWord(fth, &w);
+  forth_storeWord(fth, &w);
+  if(fth->dict.size == fth->dict.cap) {
+    fth->dict.cap = fth->dict.cap ? fth->dict.cap*2 : 64;
+    fth->dict.words = realloc(fth->dict.words,
+        sizeof(ForthWord)*fth->dict.cap);
+  }
+  fth->dict.words[fth->dict.size++] = w;
+
+  if(fth->dict.size*2 > fth->dict.hash_size)
+    forth_hashGrow(fth);
+  else
+    forth_hashInsert(fth, fth->dict.size-1);
+
+  forth_jitWord(fth, fth->dict.size-1);
 }
 
 void forth_addDefaultWords(ForthInstance *fth) {
@@ -178,30 +1023,126 @@ void forth_addDefaultWords(ForthInstance *fth) {
   forth_addInstruction(&w, FORTH_DEC);
   forth_addWord(fth, w);
 
-  forth_initWord(&w, "<=");
-  forth_addInstruction(&w, FORTH_DEC);
-  forth_addInstruction(&w, FORTH_LESS);
+  forth_initWord(&w, "<=");
+  forth_addInstruction(&w, FORTH_DEC);
+  forth_addInstruction(&w, FORTH_LESS);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, ">=");
+  forth_addInstruction(&w, FORTH_INC);
+  forth_addInstruction(&w, FORTH_GREATER);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "=");
+  forth_addInstruction(&w, FORTH_EQUAL);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "BYE");
+  forth_addInstruction(&w, FORTH_BYE);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "@");
+  forth_addInstruction(&w, FORTH_GETMEM);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "!");
+  forth_addInstruction(&w, FORTH_SETMEM);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "C@");
+  forth_addInstruction(&w, FORTH_CGETMEM);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "C!");
+  forth_addInstruction(&w, FORTH_CSETMEM);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "CELLS");
+  forth_addInstruction(&w, FORTH_MULLIT);
+  forth_addInteger(&w, FORTH_CELL);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "CELL+");
+  forth_addInstruction(&w, FORTH_ADDLIT);
+  forth_addInteger(&w, FORTH_CELL);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "MOVE");
+  forth_addInstruction(&w, FORTH_MOVE);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "CMOVE");
+  forth_addInstruction(&w, FORTH_CMOVE);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "FILL");
+  forth_addInstruction(&w, FORTH_FILL);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "SUM");
+  forth_addInstruction(&w, FORTH_SUM);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "DOT");
+  forth_addInstruction(&w, FORTH_DOT);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "V+");
+  forth_addInstruction(&w, FORTH_VADD);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "V*");
+  forth_addInstruction(&w, FORTH_VMUL);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "VMIN");
+  forth_addInstruction(&w, FORTH_VMIN);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "VMAX");
+  forth_addInstruction(&w, FORTH_VMAX);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "COUNT-EQUAL");
+  forth_addInstruction(&w, FORTH_COUNTEQ);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "SORT");
+  forth_addInstruction(&w, FORTH_SORT);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "BSEARCH");
+  forth_addInstruction(&w, FORTH_BSEARCH);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "TABLE-NEW");
+  forth_addInstruction(&w, FORTH_TABLENEW);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "TABLE-PUT");
+  forth_addInstruction(&w, FORTH_TABLEPUT);
   forth_addWord(fth, w);
 
-  forth_initWord(&w, ">=");
-  forth_addInstruction(&w, FORTH_INC);
-  forth_addInstruction(&w, FORTH_GREATER);
+  forth_initWord(&w, "TABLE-GET");
+  forth_addInstruction(&w, FORTH_TABLEGET);
   forth_addWord(fth, w);
 
-  forth_initWord(&w, "=");
-  forth_addInstruction(&w, FORTH_EQUAL);
+  forth_initWord(&w, "START");
+  forth_addInstruction(&w, FORTH_START);
   forth_addWord(fth, w);
 
-  forth_initWord(&w, "BYE");
-  forth_addInstruction(&w, FORTH_BYE);
+  forth_initWord(&w, "PAUSE");
+  forth_addInstruction(&w, FORTH_PAUSE);
   forth_addWord(fth, w);
 
-  forth_initWord(&w, "@");
-  forth_addInstruction(&w, FORTH_GETMEM);
+  forth_initWord(&w, "STOP");
+  forth_addInstruction(&w, FORTH_STOP);
   forth_addWord(fth, w);
 
-  forth_initWord(&w, "!");
-  forth_addInstruction(&w, FORTH_SETMEM);
+  forth_initWord(&w, "ERASE");
+  forth_addInstruction(&w, FORTH_PUSH);
+  forth_addInteger(&w, 0);
+  forth_addInstruction(&w, FORTH_FILL);
   forth_addWord(fth, w);
 
   forth_initWord(&w, "HERE");
@@ -216,129 +1157,241 @@ void forth_addDefaultWords(ForthInstance *fth) {
   forth_addInstruction(&w, FORTH_EMIT);
   forth_addWord(fth, w);
 
+  forth_initWord(&w, "BLOCK");
+  forth_addInstruction(&w, FORTH_BLOCK);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "BUFFER");
+  forth_addInstruction(&w, FORTH_BUFFER);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "UPDATE");
+  forth_addInstruction(&w, FORTH_UPDATE);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "FLUSH");
+  forth_addInstruction(&w, FORTH_FLUSH);
+  forth_addWord(fth, w);
+
   fth->dict.lock = fth->dict.size;
 }
 
-ForthInstance *forth_newInstance() {
-  ForthInstance *fth = malloc(sizeof(ForthInstance));
-  fth->sp = 0;
-  fth->lsp = 0;
+/* an instance with no words at all, for forth_loadImage to fill, or 0 if
+ * it cannot have the sizes asked for */
+ForthInstance *forth_emptyInstance(const ForthSizes *sizes) {
+  ForthInstance *fth = forth_allocRuntime(sizes);
+  if(!fth)
+    return 0;
+  forth_initRuntime(fth);
+  fth->memory = 0;
+  fth->block.fd = -1;
+  fth->block.size = 0;
+  fth->block.mapped = 0;
+  fth->block.current = -1;
+  fth->block.updated = 0;
+  fth->block.window = false;
   fth->dict.size = 0;
+  fth->dict.cap = 0;
   fth->dict.words = 0;
   fth->dict.lock = 0;
-  fth->quit = false;
-  fth->here = 0;
-  forth_addDefaultWords(fth);
+  fth->dict.hash = 0;
+  fth->dict.hash_size = 0;
+  fth->inline_size = FORTH_INLINE_SIZE;
+  fth->stale_inlines = false;
+  fth->jit = false;
+  fth->profiling = false;
+  fth->profile = 0;
+  fth->tasks.list = 0;
+  fth->tasks.size = 0;
+  fth->tasks.cap = 0;
+  fth->tasks.started = 0;
+  fth->tasks.main.stack = 0;
+  fth->tasks.main.stack_cap = 0;
+  fth->task = 0;
+  fth->record = 0;
+  fth->arena = 0;
+  fth->frozen = 0;
+  fth->image = 0;
+  fth->image_size = 0;
+
+  if(!forth_mapMemory(fth)) {
+    forth_freeInstance(fth);
+    return 0;
+  }
   return fth;
 }
 
-void forth_freeInstance(ForthInstance *fth) {
-  for(int i = 0; i < fth->dict.size; i++)
-    forth_freeWord(fth->dict.words[i]);
-  if(fth->dict.words)
-    free(fth->dict.words);
+ForthInstance *forth_sizedInstance(const ForthSizes *sizes) {
+  ForthInstance *fth = forth_emptyInstance(sizes);
+  if(fth)
+    forth_addDefaultWords(fth);
+  return fth;
+}
+
+ForthInstance *forth_newInstance() {
+  return forth_sizedInstance(0);
+}
 
-  free(fth);
+/* sends output to sink from now on, what is buffered goes to the old one */
+void forth_setOutput(ForthInstance *fth,
+    void (*sink)(void *data, const char *s, int n), void *data)
+{
+  forth_flushOutput(fth);
+  fth->out.sink = sink ? sink : forth_stdoutSink;
+  fth->out.data = data;
 }
 
-bool forth_has(ForthInstance *fth, int n) {
-  if(fth->sp >= n)
-    return true;
-  else {
-    printf("stack underflow !\n");
-    return false;
+/* formats straight into the output buffer, for messages and PRINTDEBUG */
+void forth_printf(ForthInstance *fth, const char *format, ...) {
+  va_list args;
+  int room = fth->out.cap - fth->out.size;
+  va_start(args, format);
+  int n = vsnprintf(fth->out.buf + fth->out.size, room, format, args);
+  va_end(args);
+  if(n < room) {
+    fth->out.size += n;
+    return;
   }
+
+  char *s = malloc(n+1);
+  va_start(args, format);
+  vsnprintf(s, n+1, format, args);
+  va_end(args);
+  forth_putString(fth, s);
+  free(s);
 }
 
-int forth_pop(ForthInstance *fth) {
-  if(forth_has(fth, 1))
-    return fth->stack[--(fth->sp)];
-  else
-    return 0;
+void forth_freeInstance(ForthInstance *fth) {
+  forth_flushOutput(fth);
+  if(!fth->frozen || fth->dict.words != fth->frozen->words) {
+    for(int i = 0; i < fth->dict.size; i++)
+      forth_freeWord(fth->dict.words[i]);
+    if(fth->dict.words)
+      free(fth->dict.words);
+    if(fth->dict.hash)
+      free(fth->dict.hash);
+  }
+  if(fth->frozen)
+    forth_releaseDict(fth->frozen);
+  forth_freeArena(fth->arena);
+  forth_freeProfile(fth);
+  forth_freeTasks(fth);
+  forth_freeImage(fth);
+  forth_freeBlocks(fth);
+  forth_freeRuntime(fth);
 }
 
-void forth_push(ForthInstance *fth, int n) {
-  if(fth->sp >= FORTH_STACK_SIZE)
-    printf("stack overflow !\n");
-  else
-    fth->stack[fth->sp++] = n;
+/* ALLOT, data space grows to take here as far as max_memory */
+void forth_allot(ForthInstance *fth, int n) {
+  long here = (long)fth->here + n;
+  if(!forth_growMemory(fth, here)) {
+    forth_printf(fth, "data space full !\n");
+    return;
+  }
+  fth->here = here;
 }
 
-char **forth_splitString(char *text) {
-  char **strings = 0;
-  int num_strings = 0;
+/* TABLE-NEW, a hash table for n keys allotted at here. -1 if data space
+ * is full, which the table words then refuse */
+int forth_tableNew(ForthInstance *fth, int n) {
+  int addr = fth->here;
+  forth_allot(fth, forth_tableBytes(n));
+  if(fth->here == addr)
+    return -1;
+  forth_tableInit(fth, addr, n);
+  return addr;
+}
 
-  int max = 50;
-  const int buf = 20;
-  char *s = malloc(max);
+/* the source is tokenized in place: each token is a view into the text,
+ * NUL terminated by overwriting the character that ended it, and tokens
+ * are handed out one at a time so the text is never copied */
+typedef struct forthTokenizer {
+  char *c;
+  int len;
+  char quote;
+  bool comment, upper, empty;
+} ForthTokenizer;
+
+void forth_initTokenizer(ForthTokenizer *t, char *text) {
+  t->c = text;
+  t->len = 0;
+  t->quote = 0;
+  t->comment = false;
+  t->upper = true;
+  t->empty = false;
+}
+
+static bool forth_isQuote(const char *s) {
+  return strcmp(s, ".\"") == 0 || strcmp(s, ".(") == 0
+    || strcmp(s, ".'") == 0;
+}
+
+static bool forth_keepsCase(const char *s) {
+  return strcmp(s, "INCLUDE") == 0 || strcmp(s, "SAVE-IMAGE") == 0
+    || strcmp(s, "BLOCK-FILE") == 0;
+}
+
+/* returns the next token, or 0 at the end of the text */
+char *forth_nextToken(ForthTokenizer *t) {
+  if(t->empty) {
+    /* ." at the end of a line prints an empty string */
+    t->empty = false;
+    t->len = 0;
+    return "";
+  }
+
+  char *s = t->c;
   int len = 0;
 
-  bool comment = false;
-  char quote = 0;
-  bool upper = true;
+  for(char *c = t->c; c; c++) {
+    if(!len)
+      s = c;
 
-  for(char *c = text; ; c++) {
     if(*c == '\n' || *c == 0) {
-      s[len] = 0;
-      len = 0;
+      char *next = *c ? c+1 : 0;
+      *c = 0;
+      t->comment = false;
 
-      if(s[0] || quote) {
-        if(!quote && upper)
+      if(len || t->quote) {
+        if(!t->quote && t->upper)
           forth_uppercase(s);
-        else if(strcmp(s, ".\"") == 0
-            || strcmp(s, ".(") == 0
-            || strcmp(s, ".'") == 0)
+        else if(forth_isQuote(s))
           s[1] = '"';
 
-        if(!quote && strcmp(s, "\\") == 0)
-          continue;
-
-        strings = realloc(strings, sizeof(char*)*(++num_strings));
-        strings[num_strings-1] = malloc(strlen(s)+1);
-        strcpy(strings[num_strings-1], s);
-
-        upper = true;
-
-        if(quote)
-          continue;
+        /* a string carries on as a new token on the next line */
+        if(t->quote || strcmp(s, "\\") != 0) {
+          t->upper = true;
+          if(!t->quote) {
+            if(strcmp(s, ".\"") == 0)
+              t->empty = true;
+            else if(forth_keepsCase(s))
+              t->upper = false;
+          }
 
-        if(strcmp(s, ".\"") == 0) {
-          strings = realloc(strings, sizeof(char*)*(++num_strings));
-          strings[num_strings-1] = malloc(1);
-          strings[num_strings-1][0] = 0;
+          t->c = next;
+          t->len = len;
+          return s;
         }
-        else if(strcmp(s, "INCLUDE") == 0)
-          upper = false;
       }
 
-      comment = false;
-      quote = 0;
-
-      if(*c == 0)
+      if(!next)
         break;
-
+      len = 0;
       continue;
     }
 
-    if(comment)
+    if(t->comment)
       continue;
 
-    if(quote) {
-      if(*c == quote) {
-        s[len] = 0;
-        len = 0;
-        strings = realloc(strings, sizeof(char*)*(++num_strings));
-        strings[num_strings-1] = malloc(strlen(s)+1);
-        strcpy(strings[num_strings-1], s);
-        quote = 0;
-      }
-      else {
-        s[len++] = *c;
-        if(len > max-buf) {
-          max += buf;
-          s = realloc(s, max);
-        }
+    if(t->quote) {
+      if(*c == t->quote) {
+        *c = 0;
+        t->quote = 0;
+        t->c = c+1;
+        t->len = len;
+        return s;
       }
+      len++;
       continue;
     }
 
@@ -346,286 +1399,268 @@ char **forth_splitString(char *text) {
       if(!len)
         continue;
 
-      s[len] = 0;
-      len = 0;
-
+      *c = 0;
       if(strcmp(s, "\\") == 0) {
-        comment = true;
+        t->comment = true;
+        len = 0;
         continue;
       }
 
-      if(strcmp(s, ".\"") == 0
-          || strcmp(s, ".(") == 0
-          || strcmp(s, ".'") == 0) {
-        quote = s[1];
-        if(quote == '(')
-          quote = ')';
+      if(forth_isQuote(s)) {
+        t->quote = s[1] == '(' ? ')' : s[1];
         s[1] = '"';
       }
 
-      if(upper)
+      if(t->upper)
         forth_uppercase(s);
-      strings = realloc(strings, sizeof(char*)*(++num_strings));
-      strings[num_strings-1] = malloc(strlen(s)+1);
-      strcpy(strings[num_strings-1], s);
+      t->upper = !forth_keepsCase(s);
 
-      upper = true;
-
-      if(strcmp(s, "INCLUDE") == 0)
-        upper = false;
-
-      continue;
+      t->c = c+1;
+      t->len = len;
+      return s;
     }
 
-    s[len++] = *c;
-    if(len > max-buf) {
-      max += buf;
-      s = realloc(s, max);
-    }
+    len++;
   }
 
-  free(s);
-
-  strings = realloc(strings, sizeof(char*)*(++num_strings));
-  strings[num_strings-1] = 0;
+  t->c = 0;
+  return 0;
+}
 
-  return strings;
+/* the engine is either a switch loop or, with FORTH_THREADED, a chain of
+ * computed gotos so that each opcode ends in its own indirect jump */
+#ifdef FORTH_THREADED
+#define FORTH_OP(op) op_##op
+#define FORTH_NEXT \
+  if(pc >= size) \
+    goto ret; \
+  PROFILE_OP(); \
+  goto *labels[program[pc++]]
+#else
+#define FORTH_OP(op) case op
+#define FORTH_NEXT break
+#endif
+
+/* a verified word cannot underflow once the entry depth is known to
+ * cover what it needs, nor overflow if its peak still fits */
+static bool forth_fits(ForthInstance *fth, ForthWord *w) {
+  return w->safe && fth->sp >= w->need
+    && fth->sp + w->peak <= fth->stack_size
+    && fth->lsp + w->lpeak <= fth->lstack_size;
 }
 
+#define FORTH_ENGINE forth_runChecked
+#define FORTH_CHECKED 1
+#define FORTH_PROFILE 0
+#include "engine.h"
+#undef FORTH_ENGINE
+#undef FORTH_CHECKED
+#undef FORTH_PROFILE
+
+#define FORTH_ENGINE forth_runUnchecked
+#define FORTH_CHECKED 0
+#define FORTH_PROFILE 0
+#include "engine.h"
+#undef FORTH_ENGINE
+#undef FORTH_CHECKED
+#undef FORTH_PROFILE
+
+#define FORTH_ENGINE forth_runProfiled
+#define FORTH_CHECKED 1
+#define FORTH_PROFILE 1
+#include "engine.h"
+#undef FORTH_ENGINE
+#undef FORTH_CHECKED
+#undef FORTH_PROFILE
+
 void forth_runWord(ForthInstance *fth, ForthWord w) {
-  if(fth->quit)
-    return;
+  if(fth->profiling)
+    forth_runProfiled(fth, &w);
+  else if(!forth_fits(fth, &w))
+    forth_runChecked(fth, &w);
+  else if(w.jit && !fth->quit)
+    w.jit(fth);
+  else
+    forth_runUnchecked(fth, &w);
+}
 
-  int pc = 0;
-  int n1, n2, n3;
-  while(pc < w.size)
-    switch(w.program[pc++]) {
-    case FORTH_PUSH:
-      forth_push(fth, forth_chars2int(w.program+pc));
-      pc += 4;
-      break;
-    case FORTH_PLUS:
-      forth_push(fth, forth_pop(fth)+forth_pop(fth));
-      break;
-    case FORTH_MUL:
-      forth_push(fth, forth_pop(fth)*forth_pop(fth));
-      break;
-    case FORTH_MINUS:
-      n1 = forth_pop(fth);
-      forth_push(fth, forth_pop(fth)-n1);
-      break;
-    case FORTH_DIV:
-      n1 = forth_pop(fth);
-      forth_push(fth, forth_pop(fth)/n1);
-      break;
-    case FORTH_MOD:
-      n1 = forth_pop(fth);
-      forth_push(fth, forth_pop(fth)%n1);
-      break;
-    case FORTH_DUP:
-      n1 = forth_pop(fth);
-      forth_push(fth, n1);
-      forth_push(fth, n1);
-      break;
-    case FORTH_SWAP:
-      if(forth_has(fth, 2)) {
-        n1 = fth->stack[fth->sp-1];
-        fth->stack[fth->sp-1] = fth->stack[fth->sp-2];
-        fth->stack[fth->sp-2] = n1;
-      }
-      break;
-    case FORTH_DROP:
-      forth_pop(fth);
-      break;
-    case FORTH_ROT:
-      if(forth_has(fth, 3)) {
-        n1 = fth->stack[fth->sp-1];
-        fth->stack[fth->sp-1] = fth->stack[fth->sp-3];
-        fth->stack[fth->sp-3] = fth->stack[fth->sp-2];
-        fth->stack[fth->sp-2] = n1;
-      }
-      break;
-    case FORTH_OVER:
-      if(forth_has(fth, 2))
-        forth_push(fth, fth->stack[fth->sp-2]);
-      break;
-    case FORTH_DEPTH:
-      forth_push(fth, fth->sp);
-      break;
-    case FORTH_FULLSTOP:
-      printf("%d ", forth_pop(fth));
-      break;
-    case FORTH_CR:
-      printf("\n");
-      break;
-    case FORTH_CALL:
-      n1 = forth_chars2int(w.program+pc);
-      forth_runWord(fth, fth->dict.words[n1]);
-      pc += 4;
-      break;
-    case FORTH_RECURSE:
-      forth_runWord(fth, w);
-      break;
-    case FORTH_JUMP:
-      pc = forth_chars2int(w.program+pc);
-      break;
-    case FORTH_JZ:
-      if(!forth_pop(fth))
-        pc = forth_chars2int(w.program+pc);
-      else
-        pc += 4;
-      break;
-    case FORTH_JNZ:
-      if(forth_pop(fth))
-        pc = forth_chars2int(w.program+pc);
-      else
-        pc += 4;
-      break;
-    case FORTH_DO:
-      fth->lstack[fth->lsp++] = forth_pop(fth);
-      fth->lstack[fth->lsp++] = forth_pop(fth);
-      break;
-    case FORTH_LOOPPLUS:
-      fth->lstack[fth->lsp-2] += forth_pop(fth) - 1;
-    case FORTH_LOOP:
-      n1 = fth->lstack[fth->lsp-1];
-      fth->lstack[fth->lsp-2]++;
-      n2 = fth->lstack[fth->lsp-2];
-      if(n2 < n1)
-        pc = forth_chars2int(w.program+pc);
-      else {
-        fth->lsp -= 2;
-        pc += 4;
-      }
-      break;
-    case FORTH_I:
-      forth_push(fth, fth->lstack[fth->lsp-2]);
-      break;
-    case FORTH_INC:
-      if(forth_has(fth, 1))
-        fth->stack[fth->sp-1]++;
-      break;
-    case FORTH_DEC:
-      if(forth_has(fth, 1))
-        fth->stack[fth->sp-1]--;
-      break;
-    case FORTH_GREATER:
-      n1 = forth_pop(fth);
-      n2 = forth_pop(fth);
-      forth_push(fth, n2 > n1);
-      break;
-    case FORTH_LESS:
-      n1 = forth_pop(fth);
-      n2 = forth_pop(fth);
-      forth_push(fth, n2 < n1);
-      break;
-    case FORTH_EQUAL:
-      forth_push(fth, forth_pop(fth) == forth_pop(fth));
-      break;
-    case FORTH_PUTSTR:
-      printf("%s", w.strings[forth_chars2int(w.program+pc)]);
-      pc += 4;
-      break;
-    case FORTH_BYE:
-      fth->quit = true;
-      return;
-    case FORTH_HERE:
-      forth_push(fth, fth->here);
-      break;
-    case FORTH_ALLOT:
-      fth->here += forth_pop(fth);
-      break;
-    case FORTH_SETMEM:
-      n1 = forth_pop(fth);
-      fth->memory[n1] = forth_pop(fth);
-      break;
-    case FORTH_GETMEM:
-      n1 = forth_pop(fth);
-      forth_push(fth, fth->memory[n1]);
-      break;
-    case FORTH_EMIT:
-      printf("%c", forth_pop(fth));
-      break;
-    }
+/* runs the task forth_pause switched to, from the start of w or with w
+ * 0 from where its PAUSE left it */
+void forth_runTask(ForthInstance *fth, ForthWord *w) {
+  forth_runChecked(fth, w);
+}
+
+/* runs the single instruction at pc of a dictionary word, native code
+ * hands the opcodes it does not compile back to the interpreter here */
+void forth_runOp(ForthInstance *fth, int index, int pc) {
+  ForthWord op = fth->dict.words[index];
+  op.program += pc;
+  op.size = forth_opSize(op.program[0]);
+  forth_runChecked(fth, &op);
+}
+
+/* how forth_printWord and the profile report show an opcode */
+const char *forth_opName(int op) {
+  switch(op) {
+  case FORTH_PLUS:
+    return "+";
+  case FORTH_MINUS:
+    return "-";
+  case FORTH_DIV:
+    return "/";
+  case FORTH_MUL:
+    return "*";
+  case FORTH_MOD:
+    return "MOD";
+  case FORTH_PUSH:
+    return "push";
+  case FORTH_DROP:
+    return "DROP";
+  case FORTH_DO:
+    return "DO";
+  case FORTH_LOOP:
+    return "LOOP";
+  case FORTH_JZ:
+    return "jz";
+  case FORTH_JNZ:
+    return "jnz";
+  case FORTH_JUMP:
+    return "jump";
+  case FORTH_CR:
+    return "CR";
+  case FORTH_FULLSTOP:
+    return ".";
+  case FORTH_CALL:
+    return "call";
+  case FORTH_TAILCALL:
+    return "tailcall";
+  case FORTH_RECURSE:
+    return "RECURSE";
+  case FORTH_SWAP:
+    return "SWAP";
+  case FORTH_DUP:
+    return "DUP";
+  case FORTH_OVER:
+    return "OVER";
+  case FORTH_ROT:
+    return "ROT";
+  case FORTH_I:
+    return "I";
+  case FORTH_INC:
+    return "1+";
+  case FORTH_DEC:
+    return "1-";
+  case FORTH_GREATER:
+    return ">";
+  case FORTH_LESS:
+    return "<";
+  case FORTH_EQUAL:
+    return "=";
+  case FORTH_DEPTH:
+    return "DEPTH";
+  case FORTH_PUTSTR:
+    return ".\" ";
+  case FORTH_BYE:
+    return "BYE";
+  case FORTH_GETMEM:
+    return "@";
+  case FORTH_SETMEM:
+    return "!";
+  case FORTH_CGETMEM:
+    return "C@";
+  case FORTH_CSETMEM:
+    return "C!";
+  case FORTH_MOVE:
+    return "MOVE";
+  case FORTH_CMOVE:
+    return "CMOVE";
+  case FORTH_FILL:
+    return "FILL";
+  case FORTH_SUM:
+    return "SUM";
+  case FORTH_DOT:
+    return "DOT";
+  case FORTH_VADD:
+    return "V+";
+  case FORTH_VMUL:
+    return "V*";
+  case FORTH_VMIN:
+    return "VMIN";
+  case FORTH_VMAX:
+    return "VMAX";
+  case FORTH_COUNTEQ:
+    return "COUNT-EQUAL";
+  case FORTH_SORT:
+    return "SORT";
+  case FORTH_BSEARCH:
+    return "BSEARCH";
+  case FORTH_TABLENEW:
+    return "TABLE-NEW";
+  case FORTH_TABLEPUT:
+    return "TABLE-PUT";
+  case FORTH_TABLEGET:
+    return "TABLE-GET";
+  case FORTH_TASK:
+    return "TASK";
+  case FORTH_START:
+    return "START";
+  case FORTH_PAUSE:
+    return "PAUSE";
+  case FORTH_STOP:
+    return "STOP";
+  case FORTH_HERE:
+    return "HERE";
+  case FORTH_ALLOT:
+    return "ALLOT";
+  case FORTH_EMIT:
+    return "EMIT";
+  case FORTH_BLOCK:
+    return "BLOCK";
+  case FORTH_BUFFER:
+    return "BUFFER";
+  case FORTH_UPDATE:
+    return "UPDATE";
+  case FORTH_FLUSH:
+    return "FLUSH";
+  case FORTH_LOOPPLUS:
+    return "LOOP+";
+  case FORTH_ADDLIT:
+    return "push+";
+  case FORTH_MULLIT:
+    return "push*";
+  case FORTH_DIVLIT:
+    return "push/";
+  case FORTH_MODLIT:
+    return "pushMOD";
+  case FORTH_EQUALLIT:
+    return "push=";
+  case FORTH_LESSLIT:
+    return "push<";
+  case FORTH_GREATERLIT:
+    return "push>";
+  case FORTH_SQUARE:
+    return "DUP*";
+  case FORTH_NIP:
+    return "SWAP DROP";
+  case FORTH_2DUP:
+    return "OVER OVER";
+  }
+  return "";
 }
 
 void forth_printWord(ForthInstance *fth, ForthWord w) {
   int pc = 0;
-  printf("%s:\n", w.identifier);
+  if(w.safe)
+    forth_printf(fth, "%s: ( needs %d, leaves %+d )\n", w.identifier, w.need, w.effect);
+  else
+    forth_printf(fth, "%s: ( unverified )\n", w.identifier);
+  /* execution counts from the profile, if it ran this program */
+  const long *hits = forth_profileHits(fth, &w);
   while(pc < w.size) {
-    printf("%d\t", pc);
-    switch(w.program[pc++]) {
-    case FORTH_PLUS:
-      printf("+"); break;
-    case FORTH_MINUS:
-      printf("-"); break;
-    case FORTH_DIV:
-      printf("/"); break;
-    case FORTH_MUL:
-      printf("*"); break;
-    case FORTH_MOD:
-      printf("MOD"); break;
-    case FORTH_PUSH:
-      printf("push"); break;
-    case FORTH_DROP:
-      printf("DROP"); break;
-    case FORTH_DO:
-      printf("DO"); break;
-    case FORTH_LOOP:
-      printf("LOOP"); break;
-    case FORTH_JZ:
-      printf("jz"); break;
-    case FORTH_JNZ:
-      printf("jnz"); break;
-    case FORTH_JUMP:
-      printf("jump"); break;
-    case FORTH_CR:
-      printf("CR"); break;
-    case FORTH_FULLSTOP:
-      printf("."); break;
-    case FORTH_CALL:
-      printf("call"); break;
-    case FORTH_RECURSE:
-      printf("RECURSE"); break;
-    case FORTH_SWAP:
-      printf("SWAP"); break;
-    case FORTH_DUP:
-      printf("DUP"); break;
-    case FORTH_OVER:
-      printf("OVER"); break;
-    case FORTH_ROT:
-      printf("ROT"); break;
-    case FORTH_I:
-      printf("I"); break;
-    case FORTH_INC:
-      printf("1+"); break;
-    case FORTH_DEC:
-      printf("1-"); break;
-    case FORTH_GREATER:
-      printf(">"); break;
-    case FORTH_LESS:
-      printf("<"); break;
-    case FORTH_EQUAL:
-      printf("="); break;
-    case FORTH_DEPTH:
-      printf("DEPTH"); break;
-    case FORTH_PUTSTR:
-      printf(".\" "); break;
-    case FORTH_BYE:
-      printf("BYE"); break;
-    case FORTH_GETMEM:
-      printf("@"); break;
-    case FORTH_SETMEM:
-      printf("!"); break;
-    case FORTH_HERE:
-      printf("HERE"); break;
-    case FORTH_ALLOT:
-      printf("ALLOT"); break;
-    case FORTH_EMIT:
-      printf("EMIT"); break;
-    case FORTH_LOOPPLUS:
-      printf("LOOP+"); break;
-    }
+    if(hits)
+      forth_printf(fth, "%10ld  ", hits[pc]);
+    forth_printf(fth, "%d\t%s", pc, forth_opName(w.program[pc]));
+    pc++;
     switch(w.program[pc-1]) {
     default:
       break;
@@ -635,42 +1670,63 @@ void forth_printWord(ForthInstance *fth, ForthWord w) {
     case FORTH_JZ:
     case FORTH_JUMP:
     case FORTH_PUSH:
-      printf(" %d", forth_chars2int(w.program+pc));
-      pc += 4;
+    case FORTH_ADDLIT:
+    case FORTH_MULLIT:
+    case FORTH_DIVLIT:
+    case FORTH_MODLIT:
+    case FORTH_EQUALLIT:
+    case FORTH_LESSLIT:
+    case FORTH_GREATERLIT:
+      forth_printf(fth, " %d", w.program[pc]);
+      pc++;
       break;
     case FORTH_CALL:
-      printf(" %s",
-          fth->dict.words[forth_chars2int(w.program+pc)].identifier);
-      pc += 4;
+    case FORTH_TAILCALL:
+      forth_printf(fth, " %s",
+          fth->dict.words[w.program[pc]].identifier);
+      pc++;
       break;
     case FORTH_PUTSTR:
-      printf("%s", w.strings[forth_chars2int(w.program+pc)]);
-      pc += 4;
+      forth_printf(fth, "%s", w.strings[w.program[pc]]);
+      pc++;
       break;
     }
-    printf("\n");
+    forth_printf(fth, "\n");
   }
 }
 
 void forth_callWord(ForthInstance *fth, char *string) {
   int n;
-  if(forth_isnum(string, &n))
+  if(forth_isnum(string, &n)) {
+    if(fth->record) {
+      forth_addInstruction(fth->record, FORTH_PUSH);
+      forth_addInteger(fth->record, n);
+    }
     forth_push(fth, n);
+  }
 
   else {
-    for(int i = 0; i < fth->dict.size; i++)
-      if(strcmp(fth->dict.words[i].identifier, string) == 0) {
-        forth_runWord(fth, fth->dict.words[i]);
-        return;
+    int i = forth_findWord(fth, string);
+    if(i != -1) {
+      if(fth->record && i < fth->dict.lock)
+        forth_concatWord(fth->record, fth->dict.words[i]);
+      else if(fth->record) {
+        forth_addInstruction(fth->record, FORTH_CALL);
+        forth_addInteger(fth->record, i);
       }
+      forth_runWord(fth, fth->dict.words[i]);
+      /* a turn for each task, whatever is left of them runs later */
+      forth_pause(fth);
+      return;
+    }
 
     for(int i = 0; forth_compileOnly[i]; i++)
       if(strcmp(string, forth_compileOnly[i]) == 0) {
-        printf("%s is compile only !\n");
+        forth_printf(fth, "%s is compile only !\n", string);
         return;
       }
 
-    printf("%s ?\n", string);
+    forth_printf(fth, "%s ?\n", string);
   }
 }
 
@@ -681,26 +1737,21 @@ void forth_checkAddWord(ForthInstance *fth, ForthWord w,
 
   int n;
   if(forth_isnum(w.identifier, &n)) {
-    printf("identifier cannot be an integer !\n");
+    forth_printf(fth, "identifier cannot be an integer !\n");
     return;
   }
 
-  int taken = -1;
-  for(int j = 0; j < fth->dict.size; j++)
-    if(strcmp(fth->dict.words[j].identifier, w.identifier) == 0) {
-      taken = j;
-      break;
-    }
+  int taken = forth_findWord(fth, w.identifier);
 
   if(taken != -1 && taken < fth->dict.lock) {
-    printf("cannot redefine %s\n", fth->dict.words[taken].identifier);
+    forth_printf(fth, "cannot redefine %s\n", fth->dict.words[taken].identifier);
     forth_freeWord(w);
     return;
   }
 
   for(int j = 0; forth_compileOnly[j]; j++)
     if(strcmp(forth_compileOnly[j], w.identifier) == 0) {
-      printf("cannot redefine %s\n", forth_compileOnly[j]);
+      forth_printf(fth, "cannot redefine %s\n", forth_compileOnly[j]);
       forth_freeWord(w);
       return;
     }
@@ -708,26 +1759,49 @@ void forth_checkAddWord(ForthInstance *fth, ForthWord w,
   /* valid identifier, check if and loop */
 
   if(if_sp) {
-    printf("expect THEN after IF in %s\n", w.identifier);
+    forth_printf(fth, "expect THEN after IF in %s\n", w.identifier);
     forth_freeWord(w);
     return;
   }
   if(do_sp) {
-    printf("expect LOOP after DO in %s\n", w.identifier);
+    forth_printf(fth, "expect LOOP after DO in %s\n", w.identifier);
     forth_freeWord(w);
     return;
   }
   if(begin_sp) {
-    printf("expect UNTIL after BEGIN in %s\n", w.identifier);
+    forth_printf(fth, "expect UNTIL after BEGIN in %s\n", w.identifier);
     forth_freeWord(w);
     return;
   }
 
   /* finally, add word */
 
+  forth_inlineWord(fth, &w, taken, 0);
+  forth_optimizeWord(&w);
+
   if(taken != -1) {
+    /* only the words that reach the new definition change */
+    char *set = forth_callers(fth, taken);
+
+    /* recorded top level code only ever sees the last definition, of the
+     * word itself and of everything that called or inlined it */
+    for(int pc = 0; fth->record && pc < fth->record->size;
+        pc += forth_opSize(fth->record->program[pc]))
+      if(fth->record->program[pc] == FORTH_CALL
+          && set[fth->record->program[pc+1]]) {
+        forth_printf(fth, "%s redefined after it ran, not supported by --emit-c\n",
+            w.identifier);
+        break;
+      }
+
+    forth_thaw(fth);
     forth_freeWord(fth->dict.words[taken]);
+    forth_storeWord(fth, &w);
     fth->dict.words[taken] = w;
+    if(!fth->stale_inlines)
+      forth_relink(fth, set);
+    forth_reverify(fth, set);
+    free(set);
   }
   else
     forth_addWord(fth, w);
@@ -742,12 +1816,13 @@ void forth_runString(ForthInstance *fth, char *text) {
   int do_sp = 0;
   int begin_a[FORTH_LSTACK_SIZE];
   int begin_sp = 0;
-  char **strings = forth_splitString(text);
+  ForthTokenizer t;
   ForthWord w;
   int taken;
+  char *string;
 
-  for(int i = 0; strings[i] && !fth->quit; i++) {
-    char *string = strings[i];
+  forth_initTokenizer(&t, text);
+  while(!fth->quit && (string = forth_nextToken(&t))) {
 
     if(compile) {
       int n;
@@ -765,7 +1840,8 @@ void forth_runString(ForthInstance *fth, char *text) {
       else if(strcmp(string, ".\"") == 0) {
         forth_addInstruction(&w, FORTH_PUTSTR);
         forth_addInteger(&w, w.num_strings);
-        forth_addString(&w, strings[++i]);
+        string = forth_nextToken(&t);
+        forth_addString(&w, string ? string : "");
       }
 
       else if(strcmp(string, "IF") == 0) {
@@ -781,24 +1857,24 @@ void forth_runString(ForthInstance *fth, char *text) {
       }
       else if(strcmp(string, "THEN") == 0) {
         if(if_sp <= 0) {
-          printf("expect IF before THEN in %s\n", w.identifier);
+          forth_printf(fth, "expect IF before THEN in %s\n", w.identifier);
           continue;
         }
 
         if_sp--;
         if(else_a[if_sp] != -1) {
-          forth_int2chars(else_a[if_sp]+4, w.program+if_a[if_sp]);
-          forth_int2chars(w.size, w.program+else_a[if_sp]);
+          w.program[if_a[if_sp]] = else_a[if_sp]+1;
+          w.program[else_a[if_sp]] = w.size;
         }
         else
-          forth_int2chars(w.size, w.program+if_a[if_sp]);
+          w.program[if_a[if_sp]] = w.size;
       }
 
       else if(strcmp(string, "BEGIN") == 0)
         begin_a[begin_sp++] = w.size;
       else if(strcmp(string, "UNTIL") == 0) {
         if(!begin_sp) {
-          printf("expect BEGIN before UNTIL in %s\n", w.identifier);
+          forth_printf(fth, "expect BEGIN before UNTIL in %s\n", w.identifier);
           continue;
         }
 
@@ -809,13 +1885,27 @@ void forth_runString(ForthInstance *fth, char *text) {
       else if(strcmp(string, "RECURSE") == 0)
         forth_addInstruction(&w, FORTH_RECURSE);
 
+      else if(strcmp(string, "TASK") == 0) {
+        string = forth_nextToken(&t);
+        int j = string ? forth_findWord(fth, string) : -1;
+        if(!string)
+          forth_printf(fth, "expect word after TASK in %s\n", w.identifier);
+        else if(j == -1)
+          forth_printf(fth, "%s ?\n", string);
+        else {
+          forth_addInstruction(&w, FORTH_PUSH);
+          forth_addInteger(&w, j);
+          forth_addInstruction(&w, FORTH_TASK);
+        }
+      }
+
       else if(strcmp(string, "DO") == 0) {
         forth_addInstruction(&w, FORTH_DO);
         do_a[do_sp++] = w.size;
       }
       else if(strcmp(string, "LOOP") == 0) {
         if(do_sp <= 0) {
-          printf("expect DO before LOOP in %s\n", w.identifier);
+          forth_printf(fth, "expect DO before LOOP in %s\n", w.identifier);
           continue;
         }
 
@@ -824,7 +1914,7 @@ void forth_runString(ForthInstance *fth, char *text) {
       }
       else if(strcmp(string, "LOOP+") == 0) {
         if(do_sp <= 0) {
-          printf("expect DO before LOOP+ in %s\n", w.identifier);
+          forth_printf(fth, "expect DO before LOOP+ in %s\n", w.identifier);
           continue;
         }
 
@@ -835,42 +1925,28 @@ void forth_runString(ForthInstance *fth, char *text) {
         if(do_sp)
           forth_addInstruction(&w, FORTH_I);
         else
-          printf("expect DO before I in %s\n", w.identifier);
+          forth_printf(fth, "expect DO before I in %s\n", w.identifier);
       }
 
       else {
-        bool found = false;
-        for(int i = 0; i < fth->dict.lock; i++)
-          if(strcmp(string, fth->dict.words[i].identifier) == 0) {
-            forth_concatWord(&w, fth->dict.words[i]);
-            found = true;
-            break;
-          }
-        if(found)
-          continue;
-
-        found = false;
-        for(int i = fth->dict.lock; i < fth->dict.size; i++)
-          if(strcmp(string, fth->dict.words[i].identifier) == 0) {
-            forth_addInstruction(&w, FORTH_CALL);
-            forth_addInteger(&w, i);
-            found = true;
-            break;
-          }
-        if(found)
-          continue;
-
-        printf("%s ?\n", string);
+        int j = forth_findWord(fth, string);
+        if(j == -1)
+          forth_printf(fth, "%s ?\n", string);
+        else if(j < fth->dict.lock)
+          forth_concatWord(&w, fth->dict.words[j]);
+        else {
+          forth_addInstruction(&w, FORTH_CALL);
+          forth_addInteger(&w, j);
+        }
       }
     }
 
     else {
       if(strcmp(string, ":") == 0) {
-        i++;
-        string = strings[i];
+        string = forth_nextToken(&t);
 
         if(string == 0) {
-          printf("expect identifier after :\n");
+          forth_printf(fth, "expect identifier after :\n");
           continue;
         }
         if(strcmp(string, ";") == 0)
@@ -880,27 +1956,54 @@ void forth_runString(ForthInstance *fth, char *text) {
         compile = true;
       }
 
-      else if(strcmp(string, ".\"") == 0)
-        printf("%s", strings[++i]);
+      else if(strcmp(string, ".\"") == 0) {
+        string = forth_nextToken(&t);
+        if(!string)
+          string = "";
+        if(fth->record) {
+          forth_addInstruction(fth->record, FORTH_PUTSTR);
+          forth_addInteger(fth->record, fth->record->num_strings);
+          forth_addString(fth->record, string);
+        }
+        forth_putString(fth, string);
+      }
 
       else if(strcmp(string, "PRINTDEBUG") == 0) {
-        string = strings[++i];
+        string = forth_nextToken(&t);
         if(!string) {
-          printf("expect word after PRINTDEBUG\n");
+          forth_printf(fth, "expect word after PRINTDEBUG\n");
           continue;
         }
 
-        for(int j = 0; j < fth->dict.size; j++)
-          if(strcmp(fth->dict.words[j].identifier, string) == 0) {
-            forth_printWord(fth, fth->dict.words[j]);
-            continue;
-          }
+        int j = forth_findWord(fth, string);
+        if(j != -1)
+          forth_printWord(fth, fth->dict.words[j]);
+      }
+
+      else if(strcmp(string, "TASK") == 0) {
+        string = forth_nextToken(&t);
+        if(!string) {
+          forth_printf(fth, "expect word after TASK\n");
+          continue;
+        }
+
+        int j = forth_findWord(fth, string);
+        if(j == -1) {
+          forth_printf(fth, "%s ?\n", string);
+          continue;
+        }
+        if(fth->record) {
+          forth_addInstruction(fth->record, FORTH_PUSH);
+          forth_addInteger(fth->record, j);
+          forth_addInstruction(fth->record, FORTH_TASK);
+        }
+        forth_push(fth, forth_newTask(fth, j));
       }
 
       else if(strcmp(string, "CREATE") == 0) {
-        string = strings[++i];
+        string = forth_nextToken(&t);
         if(!string) {
-          printf("expect identifier after CREATE\n");
+          forth_printf(fth, "expect identifier after CREATE\n");
           continue;
         }
 
@@ -911,36 +2014,67 @@ void forth_runString(ForthInstance *fth, char *text) {
         forth_checkAddWord(fth, w, 0, 0, 0);
       }
 
+      else if(strcmp(string, "INLINE-SIZE") == 0)
+        fth->inline_size = forth_pop(fth);
+      else if(strcmp(string, "STALE-INLINES") == 0)
+        fth->stale_inlines = forth_pop(fth);
+      else if(strcmp(string, "JIT") == 0)
+        forth_setJit(fth, forth_pop(fth));
+      else if(strcmp(string, "PROFILE-ON") == 0)
+        forth_setProfile(fth, true, false);
+      else if(strcmp(string, "PROFILE-COUNTERS") == 0)
+        forth_setProfile(fth, true, true);
+      else if(strcmp(string, "PROFILE-OFF") == 0)
+        forth_setProfile(fth, false, false);
+      else if(strcmp(string, "PROFILE-REPORT") == 0)
+        forth_profileReport(fth);
+
       else if(strcmp(string, "INCLUDE") == 0) {
-        string = strings[++i];
+        string = forth_nextToken(&t);
         if(!string) {
-          printf("expect filename after INCLUDE\n");
+          forth_printf(fth, "expect filename after INCLUDE\n");
           continue;
         }
 
         forth_runFile(fth, string);
       }
 
+      else if(strcmp(string, "BLOCK-FILE") == 0) {
+        string = forth_nextToken(&t);
+        if(!string) {
+          forth_printf(fth, "expect filename after BLOCK-FILE\n");
+          continue;
+        }
+
+        forth_blockFile(fth, string);
+      }
+
+      else if(strcmp(string, "SAVE-IMAGE") == 0) {
+        string = forth_nextToken(&t);
+        if(!string) {
+          forth_printf(fth, "expect filename after SAVE-IMAGE\n");
+          continue;
+        }
+
+        forth_saveImage(fth, string);
+      }
+
       else
         forth_callWord(fth, string);
     }
   }
 
   if(compile) {
-    printf("expect ; after : in %s\n", w.identifier);
+    forth_printf(fth, "expect ; after : in %s\n", w.identifier);
     free(w.identifier);
     free(w.program);
   }
-
-  for(int i = 0; strings[i]; i++)
-    free(strings[i]);
-  free(strings);
 }
 
 void forth_runFile(ForthInstance *fth, const char *filename) {
   FILE *fp = fopen(filename, "r");
   if(!fp) {
-    printf("failed to open %s\n", filename);
+    forth_printf(fth, "failed to open %s\n", filename);
     return;
   }
 
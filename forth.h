@@ -3,12 +3,34 @@
 #ifndef FORTH_H
 #define FORTH_H
 
+#include <stdio.h>
 #include <stdbool.h>
 
+/* default sizes, see ForthSizes */
 #define FORTH_STACK_SIZE 256
 #define FORTH_LSTACK_SIZE 128
+#define FORTH_RSTACK_SIZE 4096
 #define FORTH_ISTACK_SIZE 64
 #define FORTH_MEMORY_SIZE 65536
+#define FORTH_CELL ((int)sizeof(int))
+#define FORTH_INLINE_SIZE 16
+#define FORTH_OUTPUT_SIZE 65536
+/* data space and the block window both have to fit in an int address */
+#define FORTH_MAX_MEMORY (1 << 30)
+#define FORTH_BLOCK_SIZE 1024
+/* blocks addressable after data space, reserved once a block file opens */
+#define FORTH_MAX_BLOCKS (1 << 20)
+#define FORTH_TASK_LSTACK_SIZE 16
+#define FORTH_TASK_RSTACK_SIZE 64
+
+/* stack depth of an instruction no path reaches */
+#define FORTH_UNKNOWN (-(1 << 30))
+
+/* computed-goto dispatch needs the labels-as-values extension, build with
+ * -DFORTH_SWITCH to get the portable switch loop instead */
+#if defined(__GNUC__) && !defined(FORTH_SWITCH)
+#define FORTH_THREADED
+#endif
 
 enum {
   FORTH_PUSH,
@@ -46,42 +68,306 @@ enum {
   FORTH_ALLOT,
   FORTH_EMIT,
   FORTH_LOOPPLUS,
+  FORTH_BLOCK,
+  FORTH_BUFFER,
+  FORTH_UPDATE,
+  FORTH_FLUSH,
+  FORTH_CGETMEM,
+  FORTH_CSETMEM,
+  FORTH_MOVE,
+  FORTH_CMOVE,
+  FORTH_FILL,
+  FORTH_SUM,
+  FORTH_DOT,
+  FORTH_VADD,
+  FORTH_VMUL,
+  FORTH_VMIN,
+  FORTH_VMAX,
+  FORTH_COUNTEQ,
+  FORTH_SORT,
+  FORTH_BSEARCH,
+  FORTH_TABLENEW,
+  FORTH_TABLEPUT,
+  FORTH_TABLEGET,
+  FORTH_TASK,
+  FORTH_START,
+  FORTH_PAUSE,
+  FORTH_STOP,
+  /* superinstructions produced by forth_optimizeWord */
+  FORTH_ADDLIT,
+  FORTH_MULLIT,
+  FORTH_DIVLIT,
+  FORTH_MODLIT,
+  FORTH_EQUALLIT,
+  FORTH_LESSLIT,
+  FORTH_GREATERLIT,
+  FORTH_SQUARE,
+  FORTH_NIP,
+  FORTH_2DUP,
+  FORTH_TAILCALL,
+  /* number of opcodes, keep last */
+  FORTH_NUM_OPS,
 };
 
+struct forthInstance;
+
 typedef struct forthWord {
   char *identifier;
-  char *program;
-  int size;
+  int *program;
+  /* cells in program, and cells allocated while it is being compiled */
+  int size, cap;
   char **strings;
   int num_strings;
+  /* program as compiled, before calls were inlined - 0 if the same */
+  int *source;
+  int source_size;
+  /* stack effect proven by forth_verifyWord, meaningless unless safe */
+  bool safe;
+  int need, effect, peak, lpeak;
+  /* native code from forth_jitWord, 0 if the word is interpreted */
+  void (*jit)(struct forthInstance *fth);
+  int jit_size;
+  /* identifier, program, strings and source live in the instance arena
+   * or a loaded image rather than being the word's own */
+  bool borrowed;
 } ForthWord;
 
+/* block of the arena finished words are copied into, the data follows */
+typedef struct forthChunk {
+  struct forthChunk *next;
+  long size, used;
+} ForthChunk;
+
+/* a dictionary frozen by forth_freeze, never written again, so it can be
+ * shared by instances on any thread. The last forth_releaseDict frees it */
+typedef struct forthDict {
+  ForthWord *words;
+  int size, lock;
+  int *hash;
+  int hash_size;
+  ForthChunk *arena;
+  /* data space as far as here, and the settings it was compiled with */
+  unsigned char *memory;
+  int here;
+  int inline_size;
+  bool stale_inlines;
+  int refs;
+} ForthDict;
+
+/* source for forth_runJobs to run, and everything running it printed,
+ * NUL terminated and for the caller to free */
+typedef struct forthJob {
+  const char *input;
+  char *output;
+  int output_size;
+} ForthJob;
+
+/* what forth_sizedInstance makes an instance with, 0 for the default.
+ * Stacks are in cells and frames, the output buffer and data space in
+ * bytes. Data space starts at memory bytes and ALLOT can grow it as far
+ * as max_memory, it is reserved up front but its pages are only
+ * committed once they are touched. task_lstack and task_rstack size the
+ * loop and return stacks of each task TASK makes */
+typedef struct forthSizes {
+  int stack, lstack, rstack;
+  int output;
+  int memory, max_memory;
+  int task_lstack, task_rstack;
+} ForthSizes;
+
+/* one decoded instruction, see forth_decode */
+typedef struct forthIns {
+  int op, arg;
+  bool target, dead;
+} ForthIns;
+
+/* return address of a call in progress */
+typedef struct forthFrame {
+  ForthWord *word;
+  int pc;
+} ForthFrame;
+
+/* a word running on stacks of its own, see task.c. Its loop and return
+ * stacks are always its own, the data stack is the instance's and is
+ * kept in stack while another task has it */
+typedef struct forthTask {
+  /* dictionary index of the word, -1 once it ends and the slot is free */
+  int word;
+  bool started;
+  int *stack;
+  int stack_cap;
+  int sp, lsp, rsp;
+  int *lstack;
+  ForthFrame *rstack;
+  int lstack_size, rstack_size;
+} ForthTask;
+
 typedef struct forthInstance {
   struct {
     ForthWord *words;
-    int size;
+    int size, cap;
     int lock;
+    /* open addressing index from identifier to word, -1 marks a free slot */
+    int *hash;
+    int hash_size;
   } dict;
-  int stack[FORTH_STACK_SIZE];
-  int lstack[FORTH_LSTACK_SIZE];
-  int sp, lsp;
+  int *lstack;
+  ForthFrame *rstack;
+  int sp, lsp, rsp;
+  int stack_size, lstack_size, rstack_size;
   bool quit;
-  unsigned char memory[FORTH_MEMORY_SIZE];
+  /* user words up to inline_size cells are inlined at their call sites,
+   * unless stale_inlines is set, redefining one re-derives its callers */
+  int inline_size;
+  bool stale_inlines;
+  /* safe user words are compiled to native code, off by default */
+  bool jit;
+  /* words run in the profiling engine while set, counting into profile,
+   * which is kept once profiling stops so it can still be reported */
+  bool profiling;
+  struct forthProfile *profile;
+  /* tasks made by TASK, numbered from 1, how many are started and the
+   * stacks each gets. task is the one running, 0 while the stacks are the
+   * interpreter's, whose own are kept in main meanwhile */
+  struct {
+    ForthTask **list;
+    int size, cap, started;
+    int lstack_size, rstack_size;
+    ForthTask main;
+  } tasks;
+  ForthTask *task;
+  /* top level code is also appended here when set, see emit.c */
+  ForthWord *record;
+  /* chunks holding the bodies of the words, newest first */
+  ForthChunk *arena;
+  /* dictionary this one was attached to, dict.words and dict.hash are
+   * the frozen ones until forth_thaw gives it copies */
+  ForthDict *frozen;
+  /* mapping the dictionary was loaded from, see image.c */
+  void *image;
+  long image_size;
+  /* what words print collects here until it fills or is flushed, then
+   * goes to sink, which is fwrite to stdout unless forth_setOutput says
+   * otherwise */
+  struct {
+    char *buf;
+    int size, cap;
+    void (*sink)(void *data, const char *s, int n);
+    void *data;
+  } out;
+  /* data space, followed by the block window while a block file is open.
+   * The first memory_size bytes are accessible, max_memory are reserved */
+  unsigned char *memory;
+  int memory_size, max_memory;
   int here;
+  /* block file mapped after data space, see block.c */
+  struct {
+    int fd;
+    /* whole blocks in the file and bytes of it mapped */
+    int size;
+    long mapped;
+    /* the block UPDATE marks, and one flag per block for FLUSH */
+    int current;
+    unsigned char *updated;
+    bool window;
+  } block;
+  /* the data stack comes last and is allocated along with the instance,
+   * so it is addressed off fth rather than through another pointer */
+  int stack[];
 } ForthInstance;
 
 ForthInstance *forth_newInstance();
+ForthInstance *forth_sizedInstance(const ForthSizes *sizes);
+ForthInstance *forth_emptyInstance(const ForthSizes *sizes);
 void forth_freeInstance(ForthInstance *fth);
 
-bool forth_has(ForthInstance *fth, int n);
-int forth_pop(ForthInstance *fth);
+#include "runtime.h"
+
+void forth_setOutput(ForthInstance *fth,
+    void (*sink)(void *data, const char *s, int n), void *data);
+void forth_printf(ForthInstance *fth, const char *format, ...);
+void forth_allot(ForthInstance *fth, int n);
+int forth_tableNew(ForthInstance *fth, int n);
 
-void forth_push(ForthInstance *fth, int n);
+int forth_findWord(ForthInstance *fth, const char *identifier);
 
 void forth_runWord(ForthInstance *fth, ForthWord w);
+void forth_runTask(ForthInstance *fth, ForthWord *w);
+void forth_runOp(ForthInstance *fth, int index, int pc);
 void forth_printWord(ForthInstance *fth, ForthWord w);
+const char *forth_opName(int op);
 
 void forth_runString(ForthInstance *fth, char *text);
 void forth_runFile(ForthInstance *fth, const char *filename);
 
+/* compiler internals shared with jit.c */
+void forth_initWord(ForthWord *w, char *identifier);
+void forth_freeWord(ForthWord w);
+void forth_addInstruction(ForthWord *w, int ins);
+void forth_addInteger(ForthWord *w, int n);
+void forth_addString(ForthWord *w, char *s);
+void forth_addWord(ForthInstance *fth, ForthWord w);
+void forth_copyWord(ForthChunk **arena, ForthWord *w);
+void forth_storeWord(ForthInstance *fth, ForthWord *w);
+void forth_freeArena(ForthChunk *arena);
+void forth_ownWord(ForthWord *w);
+void forth_hashGrow(ForthInstance *fth);
+int forth_opSize(int op);
+bool forth_isJump(int op);
+void forth_verifyDepths(ForthInstance *fth, ForthWord *w,
+    int *depth, int *ldepth);
+void forth_reverify(ForthInstance *fth, const char *set);
+
+/* jit.c - x86-64 back end */
+void forth_setJit(ForthInstance *fth, bool jit);
+void forth_jitWord(ForthInstance *fth, int index);
+void forth_jitFree(ForthWord *w);
+int forth_jitCheck();
+
+/* profile.c - calls and time per word, opcode counts */
+void forth_setProfile(ForthInstance *fth, bool on, bool counters);
+void forth_profileReport(ForthInstance *fth);
+void forth_freeProfile(ForthInstance *fth);
+const long *forth_profileHits(ForthInstance *fth, ForthWord *w);
+int forth_profileEnter(ForthInstance *fth, ForthWord *w);
+void forth_profileLeave(ForthInstance *fth);
+void forth_profileUnwind(ForthInstance *fth, int depth);
+void forth_profileOp(ForthInstance *fth, int op, int pc);
+
+/* task.c - cooperative tasks */
+int forth_newTask(ForthInstance *fth, int word);
+void forth_startTask(ForthInstance *fth, int id, int n);
+bool forth_stopTask(ForthInstance *fth, int id);
+void forth_pause(ForthInstance *fth);
+void forth_runTasks(ForthInstance *fth);
+void forth_freeTasks(ForthInstance *fth);
+
+/* freeze.c - shared dictionaries */
+ForthDict *forth_freeze(ForthInstance *fth);
+ForthInstance *forth_attachInstance(ForthDict *d, const ForthSizes *sizes);
+void forth_releaseDict(ForthDict *d);
+void forth_thaw(ForthInstance *fth);
+
+/* batch.c - one dictionary over many inputs */
+void forth_runJobs(ForthDict *d, const ForthSizes *sizes, bool jit,
+    ForthJob *jobs, int num, int threads);
+
+/* image.c - dictionary snapshots */
+bool forth_saveImage(ForthInstance *fth, const char *filename);
+ForthInstance *forth_loadImage(const char *filename);
+int forth_imageCheck();
+void forth_freeImage(ForthInstance *fth);
+
+/* block.c - data space and BLOCK storage */
+bool forth_mapMemory(ForthInstance *fth);
+bool forth_growMemory(ForthInstance *fth, long size);
+void forth_blockFile(ForthInstance *fth, const char *filename);
+int forth_block(ForthInstance *fth, int n);
+void forth_update(ForthInstance *fth);
+void forth_flush(ForthInstance *fth);
+void forth_freeBlocks(ForthInstance *fth);
+
+/* emit.c - C back end */
+void forth_emitFile(const char *filename, FILE *fp);
+
 #endif
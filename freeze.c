@@ -0,0 +1,102 @@
+/* sforth - tdwsl 2022 */
+
+/* shared dictionaries. forth_freeze copies the words of an instance, with
+ * their bodies in an arena of its own, into a ForthDict that nothing
+ * writes to again. forth_attachInstance makes an instance that reads that
+ * dictionary in place, so it costs no more than an empty one. The first
+ * time such an instance adds, redefines or compiles a word forth_thaw
+ * gives it its own word array and hash index, but the bodies stay in the
+ * frozen arena and are only copied for words that are derived again */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "forth.h"
+
+ForthDict *forth_freeze(ForthInstance *fth) {
+  ForthDict *d = malloc(sizeof(ForthDict));
+  d->arena = 0;
+  d->size = fth->dict.size;
+  d->lock = fth->dict.lock;
+
+  /* native code is left to each instance, it would have to be shared
+   * and freed along with the dictionary otherwise */
+  d->words = malloc(sizeof(ForthWord)*(d->size ? d->size : 1));
+  for(int i = 0; i < d->size; i++) {
+    ForthWord w = fth->dict.words[i];
+    forth_copyWord(&d->arena, &w);
+    w.jit = 0;
+    w.jit_size = 0;
+    d->words[i] = w;
+  }
+
+  d->hash_size = fth->dict.hash_size;
+  d->hash = malloc(sizeof(int)*(d->hash_size ? d->hash_size : 1));
+  memcpy(d->hash, fth->dict.hash, sizeof(int)*d->hash_size);
+
+  d->here = fth->here;
+  if(d->here < 0)
+    d->here = 0;
+  if(d->here > fth->memory_size)
+    d->here = fth->memory_size;
+  d->memory = malloc(d->here ? d->here : 1);
+  memcpy(d->memory, fth->memory, d->here);
+  d->inline_size = fth->inline_size;
+  d->stale_inlines = fth->stale_inlines;
+
+  d->refs = 1;
+  return d;
+}
+
+ForthInstance *forth_attachInstance(ForthDict *d, const ForthSizes *sizes) {
+  /* data space has to hold what the dictionary compiled into it */
+  ForthSizes s = { 0 };
+  if(sizes)
+    s = *sizes;
+  if((s.memory > 0 ? s.memory : FORTH_MEMORY_SIZE) < d->here)
+    s.memory = d->here;
+
+  ForthInstance *fth = forth_emptyInstance(&s);
+  if(!fth)
+    return 0;
+  __atomic_add_fetch(&d->refs, 1, __ATOMIC_RELAXED);
+  fth->frozen = d;
+
+  fth->dict.words = d->words;
+  fth->dict.size = d->size;
+  fth->dict.lock = d->lock;
+  fth->dict.hash = d->hash;
+  fth->dict.hash_size = d->hash_size;
+
+  memcpy(fth->memory, d->memory, d->here);
+  fth->here = d->here;
+  fth->inline_size = d->inline_size;
+  fth->stale_inlines = d->stale_inlines;
+  return fth;
+}
+
+void forth_releaseDict(ForthDict *d) {
+  if(__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  free(d->words);
+  free(d->hash);
+  free(d->memory);
+  forth_freeArena(d->arena);
+  free(d);
+}
+
+/* copies the word array and index of a frozen dictionary before they are
+ * written to, nothing to do for an instance with its own */
+void forth_thaw(ForthInstance *fth) {
+  ForthDict *d = fth->frozen;
+  if(!d || fth->dict.words != d->words)
+    return;
+
+  fth->dict.cap = d->size*2 > 64 ? d->size*2 : 64;
+  fth->dict.words = malloc(sizeof(ForthWord)*fth->dict.cap);
+  memcpy(fth->dict.words, d->words, sizeof(ForthWord)*d->size);
+  fth->dict.hash = malloc(sizeof(int)*(d->hash_size ? d->hash_size : 1));
+  memcpy(fth->dict.hash, d->hash, sizeof(int)*d->hash_size);
+}
@@ -0,0 +1,360 @@
+/* sforth - tdwsl 2022 */
+
+/* dictionary snapshots. An image holds a header, the dictionary's
+ * ForthWord array with every pointer stored as an offset into the file,
+ * data space and a blob with the identifiers, programs and strings.
+ * Loading maps the whole file once and points the words into it, so no
+ * word is copied or allocated on its own */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "forth.h"
+
+#define FORTH_IMAGE_MAGIC "sforth\x1a"
+#define FORTH_IMAGE_VERSION 6
+
+typedef struct forthImage {
+  char magic[8];
+  /* an image only loads into the build that saved it */
+  int version, num_ops, word_size, memory_size, max_memory;
+  int size, lock, here, inline_size;
+  bool stale_inlines;
+  long words, memory;
+} ForthImage;
+
+typedef struct forthImageBuf {
+  char *data;
+  long size, cap;
+} ForthImageBuf;
+
+/* appends n bytes at an 8 byte boundary and returns their offset */
+static long forth_imageAdd(ForthImageBuf *b, const void *p, long n) {
+  long at = (b->size + 7) & ~7L;
+  if(at+n > b->cap) {
+    b->cap = (at+n)*2;
+    b->data = realloc(b->data, b->cap);
+  }
+  memset(b->data+b->size, 0, at-b->size);
+  if(p)
+    memcpy(b->data+at, p, n);
+  b->size = at+n;
+  return at;
+}
+
+bool forth_saveImage(ForthInstance *fth, const char *filename) {
+  ForthImageBuf b = { 0, 0, 0 };
+  ForthImage h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FORTH_IMAGE_MAGIC, 8);
+  h.version = FORTH_IMAGE_VERSION;
+  h.num_ops = FORTH_NUM_OPS;
+  h.word_size = sizeof(ForthWord);
+  h.memory_size = fth->memory_size;
+  h.max_memory = fth->max_memory;
+  h.size = fth->dict.size;
+  h.lock = fth->dict.lock;
+  h.here = fth->here;
+  h.inline_size = fth->inline_size;
+  h.stale_inlines = fth->stale_inlines;
+
+  forth_imageAdd(&b, 0, sizeof(ForthImage));
+  h.words = forth_imageAdd(&b, 0, sizeof(ForthWord)*fth->dict.size);
+  h.memory = forth_imageAdd(&b, fth->memory, fth->memory_size);
+
+  for(int i = 0; i < fth->dict.size; i++) {
+    ForthWord w = fth->dict.words[i];
+    w.identifier = (char*)forth_imageAdd(&b, w.identifier,
+        strlen(w.identifier)+1);
+    w.program = w.program ?
+      (int*)forth_imageAdd(&b, w.program, sizeof(int)*w.size) : 0;
+    w.source = w.source ?
+      (int*)forth_imageAdd(&b, w.source, sizeof(int)*w.source_size) : 0;
+
+    if(w.strings) {
+      long table = forth_imageAdd(&b, 0, sizeof(char*)*w.num_strings);
+      for(int j = 0; j < w.num_strings; j++) {
+        char *s = fth->dict.words[i].strings[j];
+        intptr_t at = forth_imageAdd(&b, s, strlen(s)+1);
+        memcpy(b.data+table+sizeof(char*)*j, &at, sizeof(at));
+      }
+      w.strings = (char**)table;
+    }
+
+    w.jit = 0;
+    w.jit_size = 0;
+    w.borrowed = true;
+    memcpy(b.data+h.words+sizeof(ForthWord)*i, &w, sizeof(ForthWord));
+  }
+  memcpy(b.data, &h, sizeof(ForthImage));
+
+  FILE *fp = fopen(filename, "wb");
+  bool ok = fp && fwrite(b.data, 1, b.size, fp) == b.size;
+  if(fp)
+    ok &= fclose(fp) == 0;
+  if(!ok)
+    forth_printf(fth, "failed to save %s\n", filename);
+
+  free(b.data);
+  return ok;
+}
+
+/* whether n bytes at offset at lie inside a file of size bytes, at an 8
+ * byte boundary as forth_imageAdd leaves everything but text */
+static bool forth_imageHas(long size, long at, long n, bool aligned) {
+  return at >= 0 && n >= 0 && at <= size && n <= size-at
+    && (!aligned || at % 8 == 0);
+}
+
+/* text at offset at, NUL terminated inside the file */
+static bool forth_imageText(const char *base, long size, long at) {
+  return forth_imageHas(size, at, 1, false) && memchr(base+at, 0, size-at);
+}
+
+/* whether every instruction of a program of size cells fits in it, is an
+ * opcode of this build and refers to a string, jump target and word that
+ * exist */
+static bool forth_imageProgram(const ForthWord *w, const int *program,
+    int size, int words)
+{
+  for(int pc = 0; pc < size; pc += forth_opSize(program[pc])) {
+    int op = program[pc];
+    if(op < 0 || op >= FORTH_NUM_OPS || pc + forth_opSize(op) > size)
+      return false;
+    int arg = forth_opSize(op) > 1 ? program[pc+1] : 0;
+    if(forth_isJump(op) && (arg < 0 || arg > size))
+      return false;
+    if((op == FORTH_CALL || op == FORTH_TAILCALL) && (arg < 0 || arg >= words))
+      return false;
+    if(op == FORTH_PUTSTR && (arg < 0 || arg >= w->num_strings))
+      return false;
+  }
+  return true;
+}
+
+/* whether every count and offset in the image at base stays inside it,
+ * before anything is read through them */
+static bool forth_checkImage(const char *base, long size) {
+  const ForthImage *h = (const ForthImage*)base;
+  if(h->size < 0 || h->lock < 0 || h->lock > h->size
+      || h->here < 0 || h->here > h->memory_size
+      || !forth_imageHas(size, h->words, sizeof(ForthWord)*(long)h->size,
+        true)
+      || !forth_imageHas(size, h->memory, h->memory_size, true))
+    return false;
+
+  for(int i = 0; i < h->size; i++) {
+    ForthWord w;
+    memcpy(&w, base + h->words + sizeof(ForthWord)*i, sizeof(ForthWord));
+    long program = (intptr_t)w.program, source = (intptr_t)w.source;
+    long strings = (intptr_t)w.strings;
+    if(!forth_imageText(base, size, (intptr_t)w.identifier)
+        || w.size < 0 || w.source_size < 0 || w.num_strings < 0
+        || (program && !forth_imageHas(size, program,
+          sizeof(int)*(long)w.size, true))
+        || (!program && w.size)
+        || (source && !forth_imageHas(size, source,
+          sizeof(int)*(long)w.source_size, true))
+        || (strings && !forth_imageHas(size, strings,
+          sizeof(char*)*(long)w.num_strings, true))
+        || (!strings && w.num_strings))
+      return false;
+
+    for(int j = 0; j < w.num_strings; j++) {
+      intptr_t at;
+      memcpy(&at, base + strings + sizeof(char*)*j, sizeof(at));
+      if(!forth_imageText(base, size, at))
+        return false;
+    }
+    if(!forth_imageProgram(&w, (const int*)(base + program), w.size, h->size)
+        || (source && !forth_imageProgram(&w, (const int*)(base + source),
+          w.source_size, h->size)))
+      return false;
+  }
+  return true;
+}
+
+ForthInstance *forth_loadImage(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if(fd == -1 || fstat(fd, &st) == -1) {
+    printf("failed to open %s\n", filename);
+    if(fd != -1)
+      close(fd);
+    return 0;
+  }
+
+  /* private and writable so string tables can be relocated in place */
+  char *base = mmap(0, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) {
+    printf("failed to map %s\n", filename);
+    return 0;
+  }
+
+  ForthImage *h = (ForthImage*)base;
+  if(st.st_size < sizeof(ForthImage)
+      || memcmp(h->magic, FORTH_IMAGE_MAGIC, 8) != 0
+      || h->version != FORTH_IMAGE_VERSION
+      || h->num_ops != FORTH_NUM_OPS
+      || h->word_size != sizeof(ForthWord)
+      || h->memory_size <= 0 || h->memory_size > FORTH_MAX_MEMORY
+      || h->max_memory < h->memory_size || h->max_memory > FORTH_MAX_MEMORY) {
+    printf("%s is not an image for this sforth\n", filename);
+    munmap(base, st.st_size);
+    return 0;
+  }
+  if(!forth_checkImage(base, st.st_size)) {
+    printf("%s is damaged\n", filename);
+    munmap(base, st.st_size);
+    return 0;
+  }
+
+  /* as much data space as the instance that saved it had, and as far to
+   * grow */
+  ForthSizes sizes = { 0 };
+  sizes.memory = h->memory_size;
+  sizes.max_memory = h->max_memory;
+  ForthInstance *fth = forth_emptyInstance(&sizes);
+  if(!fth) {
+    munmap(base, st.st_size);
+    return 0;
+  }
+  fth->image = base;
+  fth->image_size = st.st_size;
+  fth->dict.lock = h->lock;
+  fth->here = h->here;
+  fth->inline_size = h->inline_size;
+  fth->stale_inlines = h->stale_inlines;
+  memcpy(fth->memory, base+h->memory, h->memory_size);
+
+  /* the array is copied so that new words can still be appended to it */
+  fth->dict.size = fth->dict.cap = h->size;
+  fth->dict.words = malloc(sizeof(ForthWord)*h->size);
+  memcpy(fth->dict.words, base+h->words, sizeof(ForthWord)*h->size);
+  for(int i = 0; i < h->size; i++) {
+    ForthWord *w = &fth->dict.words[i];
+    /* nothing native survives a save, whatever the file says */
+    w->jit = 0;
+    w->jit_size = 0;
+    w->borrowed = true;
+    w->identifier = base + (intptr_t)w->identifier;
+    if(w->program)
+      w->program = (int*)(base + (intptr_t)w->program);
+    if(w->source)
+      w->source = (int*)(base + (intptr_t)w->source);
+    if(w->strings) {
+      w->strings = (char**)(base + (intptr_t)w->strings);
+      for(int j = 0; j < w->num_strings; j++)
+        w->strings[j] = base + (intptr_t)w->strings[j];
+    }
+  }
+
+  fth->dict.hash_size = 32;
+  while(fth->dict.hash_size < fth->dict.size)
+    fth->dict.hash_size *= 2;
+  forth_hashGrow(fth);
+
+  /* a proof decides whether a word runs unchecked, so none is taken from
+   * the file on trust */
+  char *set = malloc(fth->dict.size);
+  memset(set, 1, fth->dict.size);
+  forth_reverify(fth, set);
+  free(set);
+
+  return fth;
+}
+
+void forth_freeImage(ForthInstance *fth) {
+  if(fth->image)
+    munmap(fth->image, fth->image_size);
+  fth->image = 0;
+  fth->image_size = 0;
+}
+
+static void forth_imageCapture(void *data, const char *s, int n) {
+  char **out = data;
+  int size = strlen(*out);
+  *out = realloc(*out, size+n+1);
+  memcpy(*out+size, s, n);
+  (*out)[size+n] = 0;
+}
+
+/* saves an image, edits the proof of a word in it to need nothing and
+ * checks that the loaded word is proven again instead of running its
+ * DROPs unchecked */
+int forth_imageCheck() {
+  char path[] = "/tmp/sforth-image-XXXXXX";
+  int fd = mkstemp(path);
+  if(fd == -1) {
+    printf("image check: no temporary file !\n");
+    return 1;
+  }
+  close(fd);
+
+  ForthInstance *fth = forth_newInstance();
+  char define[] = ": D DROP DROP DROP ;";
+  forth_runString(fth, define);
+  bool ok = forth_saveImage(fth, path);
+  forth_freeInstance(fth);
+
+  FILE *fp = fopen(path, "r+b");
+  char *base = 0;
+  long size = 0;
+  if(ok && fp && fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) > 0) {
+    base = malloc(size);
+    rewind(fp);
+    ok = fread(base, 1, size, fp) == size;
+  }
+  else
+    ok = false;
+
+  ForthImage *h = (ForthImage*)base;
+  bool edited = false;
+  for(int i = 0; ok && i < h->size; i++) {
+    ForthWord w;
+    long at = h->words + sizeof(ForthWord)*i;
+    memcpy(&w, base+at, sizeof(ForthWord));
+    if(strcmp(base + (intptr_t)w.identifier, "D") == 0 && w.safe) {
+      w.need = 0;
+      memcpy(base+at, &w, sizeof(ForthWord));
+      edited = true;
+    }
+  }
+  if(edited) {
+    rewind(fp);
+    ok = fwrite(base, 1, size, fp) == size;
+  }
+  if(fp)
+    ok &= fclose(fp) == 0;
+  free(base);
+
+  ok &= edited;
+  fth = ok ? forth_loadImage(path) : 0;
+  unlink(path);
+  if(!fth) {
+    printf("image check: could not save and load an image !\n");
+    return 1;
+  }
+
+  /* run checked the line underflows on the second D */
+  ForthWord *d = &fth->dict.words[forth_findWord(fth, "D")];
+  char *out = calloc(1, 1);
+  char run[] = "D D D D D 1 2 3 .";
+  forth_setOutput(fth, forth_imageCapture, &out);
+  forth_runString(fth, run);
+  forth_flushOutput(fth);
+  ok = (!d->safe || d->need == 3) && strstr(out, "underflow");
+  free(out);
+  forth_freeInstance(fth);
+
+  printf(ok ? "image check: an edited proof is proven again\n"
+      : "image check: an edited proof was trusted !\n");
+  return !ok;
+}
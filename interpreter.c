@@ -2,18 +2,116 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "forth.h"
 
+/* --jobs: the file builds the dictionary, then every input runs on a copy
+ * of it, the arguments after the file or else each line of stdin */
+static int forth_batch(ForthInstance *fth, const ForthSizes *sizes,
+    const char *file, bool jit, int threads, char **inputs, int num)
+{
+  forth_runFile(fth, file);
+  forth_flushOutput(fth);
+  ForthDict *d = forth_freeze(fth);
+  forth_freeInstance(fth);
+
+  char **lines = 0;
+  if(!num) {
+    char *line = 0;
+    size_t size = 0;
+    long len;
+    while((len = getline(&line, &size, stdin)) != -1) {
+      if(len && line[len-1] == '\n')
+        line[len-1] = 0;
+      lines = realloc(lines, sizeof(char*)*(num+1));
+      lines[num++] = strdup(line);
+    }
+    free(line);
+    inputs = lines;
+  }
+
+  ForthJob *jobs = malloc(sizeof(ForthJob)*(num ? num : 1));
+  for(int i = 0; i < num; i++)
+    jobs[i].input = inputs[i];
+  forth_runJobs(d, sizes, jit, jobs, num, threads);
+
+  for(int i = 0; i < num; i++) {
+    fwrite(jobs[i].output, 1, jobs[i].output_size, stdout);
+    free(jobs[i].output);
+    if(lines)
+      free(lines[i]);
+  }
+  free(jobs);
+  free(lines);
+  forth_releaseDict(d);
+  return 0;
+}
+
 int main(int argc, char **args) {
-  if(argc > 2) {
-    printf("usage: %s <file>\n", args[0]);
+  const char *file = 0, *image = 0;
+  bool jit = false, emit = false, profile = false, counters = false;
+  int threads = 0, num_inputs = 0;
+  char **inputs = 0;
+  ForthSizes sizes = { 0 };
+
+  for(int i = 1; i < argc; i++) {
+    if(threads && file) {
+      inputs = args+i;
+      num_inputs = argc-i;
+      break;
+    }
+    else if(strcmp(args[i], "--jit") == 0)
+      jit = true;
+    else if(strcmp(args[i], "--jit-check") == 0)
+      return forth_jitCheck() != 0;
+    else if(strcmp(args[i], "--image-check") == 0)
+      return forth_imageCheck() != 0;
+    else if(strcmp(args[i], "--emit-c") == 0)
+      emit = true;
+    else if(strcmp(args[i], "--profile") == 0)
+      profile = true;
+    else if(strcmp(args[i], "--profile-counters") == 0)
+      profile = counters = true;
+    else if(strcmp(args[i], "--image") == 0 && i+1 < argc)
+      image = args[++i];
+    else if(strcmp(args[i], "--memory") == 0 && i+1 < argc
+        && atoi(args[i+1]) > 0)
+      sizes.max_memory = atoi(args[++i]);
+    else if(strcmp(args[i], "--jobs") == 0 && i+1 < argc
+        && atoi(args[i+1]) > 0)
+      threads = atoi(args[++i]);
+    else if(!file && args[i][0] != '-')
+      file = args[i];
+    else {
+      printf("usage: %s [--jit] [--jit-check] [--image-check] [--emit-c]"
+          " [--profile] [--profile-counters]\n"
+          "       [--image <image>] [--memory <bytes>] <file>\n", args[0]);
+      printf("       %s [--jit] [--image <image>] [--memory <bytes>]"
+          " --jobs <n> <file> [inputs...]\n", args[0]);
+      return 0;
+    }
+  }
+
+  if(emit && file) {
+    forth_emitFile(file, stdout);
     return 0;
   }
 
-  ForthInstance *fth = forth_newInstance();
+  ForthInstance *fth = image ? forth_loadImage(image)
+    : forth_sizedInstance(&sizes);
+  if(!fth)
+    return 1;
+  if(threads && file)
+    return forth_batch(fth, &sizes, file, jit, threads, inputs, num_inputs);
+  forth_setJit(fth, jit);
+  /* --profile reports on everything run once the program is done */
+  if(profile)
+    forth_setProfile(fth, true, counters);
 
-  if(argc == 2) {
-    forth_runFile(fth, args[1]);
+  if(file) {
+    forth_runFile(fth, file);
+    if(profile)
+      forth_profileReport(fth);
     forth_freeInstance(fth);
     return 0;
   }
@@ -45,10 +143,13 @@ int main(int argc, char **args) {
     free(s);
 
     /* ok */
+    forth_flushOutput(fth);
     if(!fth->quit)
       printf("    ok\n");
   }
 
+  if(profile)
+    forth_profileReport(fth);
   forth_freeInstance(fth);
 
   return 0;
@@ -0,0 +1,884 @@
+/* sforth - tdwsl 2022 */
+
+/* x86-64 back end. A word forth_verifyWord proved safe is compiled to a
+ * native function that keeps the data stack pointer in a register and the
+ * stack itself in fth->stack, so the interpreter and native code can hand
+ * the stacks to each other at any instruction. Opcodes that are not
+ * compiled are run through forth_runOp. Code is written to a read-write
+ * mapping that is made executable only once it is complete */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include "forth.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define FORTH_JIT
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef FORTH_JIT
+
+/* registers: rbx = fth, r12 = fth->stack, r13d = sp, r14 = fth->lstack,
+ * r15 = fth->memory, eax/ecx/edx are scratch */
+
+typedef struct forthJit {
+  unsigned char *code;
+  int size, cap;
+  /* native offset of each program cell, and of the end of the word */
+  int *at;
+  /* rel32 fields to patch with the offset of a program cell */
+  int *fix, *fix_to;
+  int num_fix;
+} ForthJit;
+
+#define FORTH_EMIT(j, s) forth_jitBytes(j, s, sizeof(s)-1)
+#define FORTH_FIELD(f) ((int)offsetof(ForthInstance, f))
+
+static void forth_jitBytes(ForthJit *j, const char *s, int n) {
+  if(j->size+n > j->cap) {
+    j->cap = (j->size+n)*2;
+    j->code = realloc(j->code, j->cap);
+  }
+  memcpy(j->code+j->size, s, n);
+  j->size += n;
+}
+
+static void forth_jit32(ForthJit *j, int n) {
+  forth_jitBytes(j, (const char*)&n, 4);
+}
+
+static void forth_jit64(ForthJit *j, uint64_t n) {
+  forth_jitBytes(j, (const char*)&n, 8);
+}
+
+/* rel32 to the native code of program cell pc */
+static void forth_jitTarget(ForthJit *j, int pc) {
+  j->fix = realloc(j->fix, sizeof(int)*(j->num_fix+1));
+  j->fix_to = realloc(j->fix_to, sizeof(int)*(j->num_fix+1));
+  j->fix[j->num_fix] = j->size;
+  j->fix_to[j->num_fix++] = pc;
+  forth_jit32(j, 0);
+}
+
+/* mov reg, [r12+r13*4+disp] and back, disp is relative to the top */
+static void forth_jitLoad(ForthJit *j, int reg, int disp) {
+  char s[] = { 0x43, 0x8b, 0x44 | reg << 3, 0xac, disp };
+  forth_jitBytes(j, s, 5);
+}
+
+static void forth_jitStore(ForthJit *j, int reg, int disp) {
+  char s[] = { 0x43, 0x89, 0x44 | reg << 3, 0xac, disp };
+  forth_jitBytes(j, s, 5);
+}
+
+/* add r13d, n */
+static void forth_jitDepth(ForthJit *j, int n) {
+  char s[] = { 0x41, 0x83, 0xc5, n };
+  forth_jitBytes(j, s, 4);
+}
+
+/* op reg, [rbx+field] */
+static void forth_jitField(ForthJit *j, int op, int reg, int field) {
+  char s[] = { op, 0x83 | reg << 3 };
+  forth_jitBytes(j, s, 2);
+  forth_jit32(j, field);
+}
+
+/* mov edx, fth->lsp */
+static void forth_jitLsp(ForthJit *j) {
+  forth_jitField(j, 0x8b, 2, FORTH_FIELD(lsp));
+}
+
+/* calls fn(fth, a, b) with the stack pointer stored for it to see */
+static void forth_jitCall(ForthJit *j, void *fn, int a, int b) {
+  FORTH_EMIT(j, "\x44\x89\xab");
+  forth_jit32(j, FORTH_FIELD(sp));
+  FORTH_EMIT(j, "\x48\x89\xdf\xbe");
+  forth_jit32(j, a);
+  FORTH_EMIT(j, "\xba");
+  forth_jit32(j, b);
+  FORTH_EMIT(j, "\x48\xb8");
+  forth_jit64(j, (uint64_t)(uintptr_t)fn);
+  FORTH_EMIT(j, "\xff\xd0\x44\x8b\xab");
+  forth_jit32(j, FORTH_FIELD(sp));
+}
+
+/* leaves through the epilogue once BYE has been run */
+static void forth_jitQuit(ForthJit *j, int end) {
+  FORTH_EMIT(j, "\x80\xbb");
+  forth_jit32(j, FORTH_FIELD(quit));
+  FORTH_EMIT(j, "\x00\x0f\x85");
+  forth_jitTarget(j, end);
+}
+
+/* cmp eax, ...; setcc al; movzx eax, al */
+static void forth_jitFlag(ForthJit *j, int cc) {
+  char s[] = { 0x0f, 0x90 | cc, 0xc0, 0x0f, 0xb6, 0xc0 };
+  forth_jitBytes(j, s, 6);
+}
+
+#define FORTH_CC_E 0x4
+#define FORTH_CC_L 0xc
+#define FORTH_CC_G 0xf
+
+static void forth_jitCallWord(ForthInstance *fth, int index) {
+  ForthWord *w = &fth->dict.words[index];
+  if(w->jit)
+    w->jit(fth);
+  else
+    forth_runWord(fth, *w);
+}
+
+/* printing only touches the output buffer, so native code calls into it
+ * directly rather than through forth_runOp */
+static void forth_jitPrint(ForthInstance *fth, int op, int unused) {
+  if(op == FORTH_CR)
+    forth_putChar(fth, '\n');
+  else if(op == FORTH_EMIT)
+    forth_putChar(fth, fth->stack[--fth->sp]);
+  else
+    forth_putNumber(fth, fth->stack[--fth->sp]);
+}
+
+/* so are ALLOT and TABLE-NEW, which may have to make more data space
+ * accessible, and the bulk memory words, which are a single call into
+ * libc. Neither moves data space, so r15 stays good */
+static void forth_jitMemory(ForthInstance *fth, int op, int unused) {
+  if(op == FORTH_ALLOT) {
+    forth_allot(fth, fth->stack[--fth->sp]);
+    return;
+  }
+  if(op == FORTH_TABLENEW) {
+    int *top = fth->stack + fth->sp - 1;
+    *top = forth_tableNew(fth, *top);
+    return;
+  }
+
+  int *top = fth->stack + (fth->sp -= 3);
+  if(op == FORTH_MOVE)
+    forth_move(fth, top[0], top[1], top[2]);
+  else if(op == FORTH_CMOVE)
+    forth_cmove(fth, top[0], top[1], top[2]);
+  else
+    forth_fill(fth, top[0], top[1], top[2]);
+}
+
+/* the array words are loops of their own, so they are called the same
+ * way, leaving any result where their first argument was */
+static void forth_jitArray(ForthInstance *fth, int op, int unused) {
+  int *top = fth->stack + fth->sp;
+  switch(op) {
+  case FORTH_SUM:
+    top[-2] = forth_sum(fth, top[-2], top[-1]);
+    fth->sp -= 1;
+    break;
+  case FORTH_VMIN:
+  case FORTH_VMAX:
+    top[-2] = forth_extreme(fth, top[-2], top[-1], op == FORTH_VMAX);
+    fth->sp -= 1;
+    break;
+  case FORTH_DOT:
+    top[-3] = forth_dot(fth, top[-3], top[-2], top[-1]);
+    fth->sp -= 2;
+    break;
+  case FORTH_COUNTEQ:
+    top[-3] = forth_countEqual(fth, top[-3], top[-2], top[-1]);
+    fth->sp -= 2;
+    break;
+  case FORTH_SORT:
+    forth_sort(fth, top[-2], top[-1]);
+    fth->sp -= 2;
+    break;
+  case FORTH_BSEARCH:
+    top[-3] = forth_bsearch(fth, top[-3], top[-2], top[-1]);
+    fth->sp -= 2;
+    break;
+  case FORTH_TABLEPUT:
+    forth_tablePut(fth, top[-1], top[-2], top[-3]);
+    fth->sp -= 3;
+    break;
+  case FORTH_TABLEGET: {
+    int value = forth_tableFind(fth, top[-1], top[-2]);
+    top[-1] = value != -1;
+    top[-2] = value == -1 ? 0 : forth_fetch(fth, value);
+    break;
+  }
+  default:
+    forth_map(fth, top[-4], top[-3], top[-2], top[-1], op == FORTH_VMUL);
+    fth->sp -= 4;
+    break;
+  }
+}
+
+static void forth_jitPutStr(ForthInstance *fth, int index, int n) {
+  forth_putString(fth, fth->dict.words[index].strings[n]);
+}
+
+static bool forth_jitNative(int op) {
+  switch(op) {
+  case FORTH_RECURSE:
+  case FORTH_BLOCK:
+  case FORTH_BUFFER:
+  case FORTH_UPDATE:
+  case FORTH_FLUSH:
+  case FORTH_TASK:
+  case FORTH_START:
+  case FORTH_PAUSE:
+  case FORTH_STOP:
+    return false;
+  default:
+    return op >= 0 && op < FORTH_NUM_OPS;
+  }
+}
+
+static void forth_jitOp(ForthJit *j, int index, int *program, int pc,
+    int end)
+{
+  int op = program[pc];
+  int arg = forth_opSize(op) > 1 ? program[pc+1] : 0;
+
+  switch(op) {
+  case FORTH_PUSH:
+    FORTH_EMIT(j, "\x43\xc7\x44\xac\x00");
+    forth_jit32(j, arg);
+    forth_jitDepth(j, 1);
+    break;
+  case FORTH_DROP:
+    forth_jitDepth(j, -1);
+    break;
+  case FORTH_PLUS:
+  case FORTH_MINUS:
+  case FORTH_MUL:
+    forth_jitLoad(j, 0, -8);
+    if(op == FORTH_PLUS)
+      FORTH_EMIT(j, "\x43\x03\x44\xac\xfc");
+    else if(op == FORTH_MINUS)
+      FORTH_EMIT(j, "\x43\x2b\x44\xac\xfc");
+    else
+      FORTH_EMIT(j, "\x43\x0f\xaf\x44\xac\xfc");
+    forth_jitStore(j, 0, -8);
+    forth_jitDepth(j, -1);
+    break;
+  case FORTH_DIV:
+  case FORTH_MOD:
+    forth_jitLoad(j, 0, -8);
+    forth_jitLoad(j, 1, -4);
+    FORTH_EMIT(j, "\x99\xf7\xf9");
+    forth_jitStore(j, op == FORTH_DIV ? 0 : 2, -8);
+    forth_jitDepth(j, -1);
+    break;
+  case FORTH_DIVLIT:
+  case FORTH_MODLIT:
+    forth_jitLoad(j, 0, -4);
+    FORTH_EMIT(j, "\xb9");
+    forth_jit32(j, arg);
+    FORTH_EMIT(j, "\x99\xf7\xf9");
+    forth_jitStore(j, op == FORTH_DIVLIT ? 0 : 2, -4);
+    break;
+  case FORTH_ADDLIT:
+    FORTH_EMIT(j, "\x43\x81\x44\xac\xfc");
+    forth_jit32(j, arg);
+    break;
+  case FORTH_MULLIT:
+    forth_jitLoad(j, 0, -4);
+    FORTH_EMIT(j, "\x69\xc0");
+    forth_jit32(j, arg);
+    forth_jitStore(j, 0, -4);
+    break;
+  case FORTH_INC:
+    FORTH_EMIT(j, "\x43\x83\x44\xac\xfc\x01");
+    break;
+  case FORTH_DEC:
+    FORTH_EMIT(j, "\x43\x83\x44\xac\xfc\xff");
+    break;
+  case FORTH_SQUARE:
+    forth_jitLoad(j, 0, -4);
+    FORTH_EMIT(j, "\x0f\xaf\xc0");
+    forth_jitStore(j, 0, -4);
+    break;
+  case FORTH_LESS:
+  case FORTH_GREATER:
+  case FORTH_EQUAL:
+    forth_jitLoad(j, 0, -8);
+    FORTH_EMIT(j, "\x43\x3b\x44\xac\xfc");
+    forth_jitFlag(j, op == FORTH_LESS ? FORTH_CC_L
+        : op == FORTH_GREATER ? FORTH_CC_G : FORTH_CC_E);
+    forth_jitStore(j, 0, -8);
+    forth_jitDepth(j, -1);
+    break;
+  case FORTH_LESSLIT:
+  case FORTH_GREATERLIT:
+  case FORTH_EQUALLIT:
+    forth_jitLoad(j, 0, -4);
+    FORTH_EMIT(j, "\x3d");
+    forth_jit32(j, arg);
+    forth_jitFlag(j, op == FORTH_LESSLIT ? FORTH_CC_L
+        : op == FORTH_GREATERLIT ? FORTH_CC_G : FORTH_CC_E);
+    forth_jitStore(j, 0, -4);
+    break;
+  case FORTH_DUP:
+    forth_jitLoad(j, 0, -4);
+    forth_jitStore(j, 0, 0);
+    forth_jitDepth(j, 1);
+    break;
+  case FORTH_OVER:
+    forth_jitLoad(j, 0, -8);
+    forth_jitStore(j, 0, 0);
+    forth_jitDepth(j, 1);
+    break;
+  case FORTH_SWAP:
+    forth_jitLoad(j, 0, -4);
+    forth_jitLoad(j, 1, -8);
+    forth_jitStore(j, 0, -8);
+    forth_jitStore(j, 1, -4);
+    break;
+  case FORTH_ROT:
+    forth_jitLoad(j, 0, -4);
+    forth_jitLoad(j, 1, -12);
+    forth_jitLoad(j, 2, -8);
+    forth_jitStore(j, 1, -4);
+    forth_jitStore(j, 2, -12);
+    forth_jitStore(j, 0, -8);
+    break;
+  case FORTH_NIP:
+    forth_jitLoad(j, 0, -4);
+    forth_jitStore(j, 0, -8);
+    forth_jitDepth(j, -1);
+    break;
+  case FORTH_2DUP:
+    forth_jitLoad(j, 0, -8);
+    forth_jitLoad(j, 1, -4);
+    forth_jitStore(j, 0, 0);
+    forth_jitStore(j, 1, 4);
+    forth_jitDepth(j, 2);
+    break;
+  case FORTH_DEPTH:
+    FORTH_EMIT(j, "\x47\x89\x6c\xac\x00");
+    forth_jitDepth(j, 1);
+    break;
+  case FORTH_HERE:
+    forth_jitField(j, 0x8b, 0, FORTH_FIELD(here));
+    forth_jitStore(j, 0, 0);
+    forth_jitDepth(j, 1);
+    break;
+  case FORTH_GETMEM:
+    forth_jitLoad(j, 0, -4);
+    FORTH_EMIT(j, "\x48\x63\xc0\x41\x8b\x04\x07");
+    forth_jitStore(j, 0, -4);
+    break;
+  case FORTH_SETMEM:
+    forth_jitLoad(j, 0, -4);
+    forth_jitLoad(j, 1, -8);
+    FORTH_EMIT(j, "\x48\x63\xc0\x41\x89\x0c\x07");
+    forth_jitDepth(j, -2);
+    break;
+  case FORTH_CGETMEM:
+    forth_jitLoad(j, 0, -4);
+    FORTH_EMIT(j, "\x48\x63\xc0\x41\x0f\xb6\x04\x07");
+    forth_jitStore(j, 0, -4);
+    break;
+  case FORTH_CSETMEM:
+    forth_jitLoad(j, 0, -4);
+    forth_jitLoad(j, 1, -8);
+    FORTH_EMIT(j, "\x48\x63\xc0\x41\x88\x0c\x07");
+    forth_jitDepth(j, -2);
+    break;
+  case FORTH_ALLOT:
+  case FORTH_TABLENEW:
+  case FORTH_MOVE:
+  case FORTH_CMOVE:
+  case FORTH_FILL:
+    forth_jitCall(j, (void*)forth_jitMemory, op, 0);
+    break;
+  case FORTH_SUM:
+  case FORTH_DOT:
+  case FORTH_VADD:
+  case FORTH_VMUL:
+  case FORTH_VMIN:
+  case FORTH_VMAX:
+  case FORTH_COUNTEQ:
+  case FORTH_SORT:
+  case FORTH_BSEARCH:
+  case FORTH_TABLEPUT:
+  case FORTH_TABLEGET:
+    forth_jitCall(j, (void*)forth_jitArray, op, 0);
+    break;
+  case FORTH_JUMP:
+    FORTH_EMIT(j, "\xe9");
+    forth_jitTarget(j, arg);
+    break;
+  case FORTH_JZ:
+  case FORTH_JNZ:
+    forth_jitLoad(j, 0, -4);
+    forth_jitDepth(j, -1);
+    if(op == FORTH_JZ)
+      FORTH_EMIT(j, "\x85\xc0\x0f\x84");
+    else
+      FORTH_EMIT(j, "\x85\xc0\x0f\x85");
+    forth_jitTarget(j, arg);
+    break;
+  case FORTH_DO:
+    forth_jitLsp(j);
+    forth_jitLoad(j, 0, -4);
+    forth_jitLoad(j, 1, -8);
+    FORTH_EMIT(j, "\x41\x89\x04\x96\x41\x89\x4c\x96\x04\x83\xc2\x02");
+    forth_jitField(j, 0x89, 2, FORTH_FIELD(lsp));
+    forth_jitDepth(j, -2);
+    break;
+  case FORTH_LOOP:
+  case FORTH_LOOPPLUS:
+    if(op == FORTH_LOOPPLUS) {
+      forth_jitLoad(j, 1, -4);
+      forth_jitDepth(j, -1);
+    }
+    forth_jitLsp(j);
+    FORTH_EMIT(j, "\x41\x8b\x44\x96\xf8");
+    if(op == FORTH_LOOPPLUS)
+      FORTH_EMIT(j, "\x01\xc8");
+    else
+      FORTH_EMIT(j, "\x83\xc0\x01");
+    FORTH_EMIT(j, "\x41\x89\x44\x96\xf8\x41\x3b\x44\x96\xfc\x0f\x8c");
+    forth_jitTarget(j, arg);
+    FORTH_EMIT(j, "\x83\xc2\xfe");
+    forth_jitField(j, 0x89, 2, FORTH_FIELD(lsp));
+    break;
+  case FORTH_I:
+    forth_jitLsp(j);
+    FORTH_EMIT(j, "\x41\x8b\x44\x96\xf8");
+    forth_jitStore(j, 0, 0);
+    forth_jitDepth(j, 1);
+    break;
+  case FORTH_BYE:
+    FORTH_EMIT(j, "\xc6\x83");
+    forth_jit32(j, FORTH_FIELD(quit));
+    FORTH_EMIT(j, "\x01\xe9");
+    forth_jitTarget(j, end);
+    break;
+  case FORTH_CR:
+  case FORTH_EMIT:
+  case FORTH_FULLSTOP:
+    forth_jitCall(j, (void*)forth_jitPrint, op, 0);
+    break;
+  case FORTH_PUTSTR:
+    forth_jitCall(j, (void*)forth_jitPutStr, index, arg);
+    break;
+  case FORTH_CALL:
+  case FORTH_TAILCALL:
+    forth_jitCall(j, (void*)forth_jitCallWord, arg, 0);
+    forth_jitQuit(j, end);
+    if(op == FORTH_TAILCALL) {
+      FORTH_EMIT(j, "\xe9");
+      forth_jitTarget(j, end);
+    }
+    break;
+  default:
+    forth_jitCall(j, (void*)forth_runOp, index, pc);
+    forth_jitQuit(j, end);
+    break;
+  }
+}
+
+void forth_jitWord(ForthInstance *fth, int index) {
+  ForthWord *w = &fth->dict.words[index];
+  forth_jitFree(w);
+  if(!fth->jit || !w->safe || index < fth->dict.lock || !w->size)
+    return;
+
+  ForthJit j;
+  j.code = 0;
+  j.size = j.cap = 0;
+  j.at = malloc(sizeof(int)*(w->size+1));
+  j.fix = j.fix_to = 0;
+  j.num_fix = 0;
+
+  /* push rbx, r12-r15; mov rbx, rdi; load the stack registers */
+  FORTH_EMIT(&j, "\x53\x41\x54\x41\x55\x41\x56\x41\x57\x48\x89\xfb");
+  FORTH_EMIT(&j, "\x4c\x8d\xa3");
+  forth_jit32(&j, FORTH_FIELD(stack));
+  FORTH_EMIT(&j, "\x44\x8b\xab");
+  forth_jit32(&j, FORTH_FIELD(sp));
+  FORTH_EMIT(&j, "\x4c\x8b\xb3");
+  forth_jit32(&j, FORTH_FIELD(lstack));
+  FORTH_EMIT(&j, "\x4c\x8b\xbb");
+  forth_jit32(&j, FORTH_FIELD(memory));
+
+  for(int pc = 0; pc < w->size; pc += forth_opSize(w->program[pc])) {
+    j.at[pc] = j.size;
+    forth_jitOp(&j, index, w->program, pc, w->size);
+  }
+  j.at[w->size] = j.size;
+
+  /* store sp; pop r15-r12, rbx; ret */
+  FORTH_EMIT(&j, "\x44\x89\xab");
+  forth_jit32(&j, FORTH_FIELD(sp));
+  FORTH_EMIT(&j, "\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\xc3");
+
+  for(int i = 0; i < j.num_fix; i++) {
+    int rel = j.at[j.fix_to[i]] - (j.fix[i]+4);
+    memcpy(j.code+j.fix[i], &rel, 4);
+  }
+
+  long page = sysconf(_SC_PAGESIZE);
+  int size = (j.size+page-1) / page * page;
+  void *code = mmap(0, size, PROT_READ|PROT_WRITE,
+      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(code != MAP_FAILED) {
+    memcpy(code, j.code, j.size);
+    if(mprotect(code, size, PROT_READ|PROT_EXEC) == 0) {
+      w->jit = (void (*)(ForthInstance*))code;
+      w->jit_size = size;
+    }
+    else
+      munmap(code, size);
+  }
+
+  free(j.code);
+  free(j.at);
+  free(j.fix);
+  free(j.fix_to);
+}
+
+/* leaves a word without native code alone, it may be a frozen one */
+void forth_jitFree(ForthWord *w) {
+  if(!w->jit)
+    return;
+  munmap((void*)w->jit, w->jit_size);
+  w->jit = 0;
+  w->jit_size = 0;
+}
+
+#else
+
+static bool forth_jitNative(int op) {
+  return false;
+}
+
+void forth_jitWord(ForthInstance *fth, int index) {
+}
+
+void forth_jitFree(ForthWord *w) {
+}
+
+#endif
+
+void forth_setJit(ForthInstance *fth, bool jit) {
+#ifndef FORTH_JIT
+  if(jit)
+    forth_printf(fth, "no native code generator for this platform\n");
+#endif
+  fth->jit = jit;
+  if(jit)
+    forth_thaw(fth);
+  for(int i = fth->dict.lock; i < fth->dict.size; i++)
+    forth_jitWord(fth, i);
+}
+
+#ifdef FORTH_JIT
+
+/* the native code is checked against the interpreter by running a small
+ * word around every opcode both ways and comparing the whole instance */
+
+static const int forth_jitEntry[][4] = {
+  { 3, -100, 7, 2 },
+  { 5, 9, -100, 7 },
+  { 9, -8, 4, 4 },
+};
+
+static void forth_jitSample(ForthWord *w, int op, int callee) {
+  /* branches and loop bodies keep the depth balanced, or the sample
+   * would not verify and could never be compiled */
+  switch(op) {
+  case FORTH_JUMP:
+    forth_addInstruction(w, FORTH_JUMP);
+    forth_addInteger(w, 4);
+    forth_addInstruction(w, FORTH_ADDLIT);
+    forth_addInteger(w, 11);
+    break;
+  case FORTH_JZ:
+  case FORTH_JNZ:
+    for(int i = 0; i < 2; i++) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, i);
+      forth_addInstruction(w, op);
+      forth_addInteger(w, w->size+3);
+      forth_addInstruction(w, FORTH_ADDLIT);
+      forth_addInteger(w, 11+i);
+    }
+    break;
+  case FORTH_DO:
+  case FORTH_LOOP:
+  case FORTH_I:
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 5);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 1);
+    forth_addInstruction(w, FORTH_DO);
+    forth_addInstruction(w, FORTH_I);
+    forth_addInstruction(w, FORTH_MUL);
+    forth_addInstruction(w, FORTH_LOOP);
+    forth_addInteger(w, 5);
+    break;
+  case FORTH_LOOPPLUS:
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 20);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, -3);
+    forth_addInstruction(w, FORTH_DO);
+    forth_addInstruction(w, FORTH_I);
+    forth_addInstruction(w, FORTH_PLUS);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 4);
+    forth_addInstruction(w, FORTH_LOOPPLUS);
+    forth_addInteger(w, 5);
+    break;
+  case FORTH_RECURSE:
+    forth_addInstruction(w, FORTH_DUP);
+    forth_addInstruction(w, FORTH_JZ);
+    forth_addInteger(w, 5);
+    forth_addInstruction(w, FORTH_DEC);
+    forth_addInstruction(w, FORTH_RECURSE);
+    break;
+  case FORTH_CALL:
+  case FORTH_TAILCALL:
+    forth_addInstruction(w, op);
+    forth_addInteger(w, callee);
+    break;
+  case FORTH_PUTSTR:
+    forth_addInstruction(w, op);
+    forth_addInteger(w, 0);
+    forth_addString(w, "ok");
+    break;
+  case FORTH_PUSH:
+    forth_addInstruction(w, op);
+    forth_addInteger(w, 42);
+    break;
+  case FORTH_MOVE:
+  case FORTH_CMOVE:
+  case FORTH_FILL:
+    /* a pattern stored first, then copied over itself or filled */
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 0x4030201);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 8);
+    forth_addInstruction(w, FORTH_SETMEM);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 8);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, op == FORTH_FILL ? 13 : 11);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, op == FORTH_FILL ? 65 : 10);
+    forth_addInstruction(w, op);
+    break;
+  case FORTH_SUM:
+  case FORTH_DOT:
+  case FORTH_VADD:
+  case FORTH_VMUL:
+  case FORTH_VMIN:
+  case FORTH_VMAX:
+  case FORTH_COUNTEQ:
+    /* eleven cells, so the vector loop and the plain one both run, of
+     * 0x07070707 but for one store -5 and one 0x4030201 */
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 8);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 48);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 7);
+    forth_addInstruction(w, FORTH_FILL);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, -5);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 16);
+    forth_addInstruction(w, FORTH_SETMEM);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 0x4030201);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 44);
+    forth_addInstruction(w, FORTH_SETMEM);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 8);
+    if(op == FORTH_DOT || op == FORTH_VADD || op == FORTH_VMUL) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 12);
+    }
+    if(op == FORTH_VADD || op == FORTH_VMUL) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 64);
+    }
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 11);
+    if(op == FORTH_COUNTEQ) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 0x7070707);
+    }
+    forth_addInstruction(w, op);
+    break;
+  case FORTH_SORT:
+  case FORTH_BSEARCH:
+    /* 3 1 2 at 8, sorted first for BSEARCH */
+    for(int i = 0; i < 3; i++) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, (i+2) % 3 + 1);
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 8 + i*4);
+      forth_addInstruction(w, FORTH_SETMEM);
+    }
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 8);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 3);
+    forth_addInstruction(w, FORTH_SORT);
+    if(op == FORTH_BSEARCH) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 8);
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 3);
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 2);
+      forth_addInstruction(w, op);
+    }
+    break;
+  case FORTH_TASK:
+  case FORTH_START:
+    /* a task for the callee, started on 5 to run once the sample ends */
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, callee);
+    forth_addInstruction(w, FORTH_TASK);
+    if(op == FORTH_START) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 5);
+      forth_addInstruction(w, FORTH_SWAP);
+      forth_addInstruction(w, op);
+    }
+    break;
+  case FORTH_TABLENEW:
+  case FORTH_TABLEPUT:
+  case FORTH_TABLEGET:
+    /* a table with 7 under 9, looked up again */
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 4);
+    forth_addInstruction(w, FORTH_TABLENEW);
+    if(op == FORTH_TABLENEW)
+      break;
+    forth_addInstruction(w, FORTH_DUP);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 7);
+    forth_addInstruction(w, FORTH_PUSH);
+    forth_addInteger(w, 9);
+    forth_addInstruction(w, FORTH_ROT);
+    forth_addInstruction(w, FORTH_TABLEPUT);
+    if(op == FORTH_TABLEGET) {
+      forth_addInstruction(w, FORTH_PUSH);
+      forth_addInteger(w, 9);
+      forth_addInstruction(w, FORTH_SWAP);
+      forth_addInstruction(w, op);
+    }
+    break;
+  default:
+    forth_addInstruction(w, op);
+    if(forth_opSize(op) > 1)
+      forth_addInteger(w, -3);
+    break;
+  }
+}
+
+/* appends to the string data points to */
+static void forth_jitCapture(void *data, const char *s, int n) {
+  char **out = data;
+  int size = strlen(*out);
+  *out = realloc(*out, size+n+1);
+  memcpy(*out+size, s, n);
+  (*out)[size+n] = 0;
+}
+
+/* runs the sample for op on a fresh instance, returning it along with
+ * everything it printed */
+static ForthInstance *forth_jitRun(int op, const int *entry, bool jit,
+    char **out)
+{
+  ForthInstance *fth = forth_newInstance();
+  ForthWord w;
+  memset(fth->memory, 0, fth->memory_size);
+  forth_setJit(fth, jit);
+
+  forth_initWord(&w, "JIT-CALLEE");
+  forth_addInstruction(&w, FORTH_PLUS);
+  forth_addInstruction(&w, FORTH_ADDLIT);
+  forth_addInteger(&w, 1);
+  forth_addWord(fth, w);
+
+  forth_initWord(&w, "JIT-SAMPLE");
+  forth_jitSample(&w, op, fth->dict.size-1);
+  forth_addWord(fth, w);
+
+  for(int i = 0; i < 4; i++)
+    forth_push(fth, entry[i]);
+
+  *out = calloc(1, 1);
+  forth_setOutput(fth, forth_jitCapture, out);
+  forth_runWord(fth, fth->dict.words[fth->dict.size-1]);
+  forth_runTasks(fth);
+  forth_flushOutput(fth);
+  return fth;
+}
+
+static bool forth_jitSame(ForthInstance *a, ForthInstance *b) {
+  return a->sp == b->sp && a->lsp == b->lsp && a->rsp == b->rsp
+    && a->quit == b->quit && a->here == b->here
+    && memcmp(a->stack, b->stack, sizeof(int)*a->sp) == 0
+    && memcmp(a->lstack, b->lstack, sizeof(int)*a->lsp) == 0
+    && a->memory_size == b->memory_size
+    && memcmp(a->memory, b->memory, a->memory_size) == 0;
+}
+
+int forth_jitCheck() {
+  int native = 0, fallback = 0, interpreted = 0, failed = 0;
+
+  for(int op = 0; op < FORTH_NUM_OPS; op++) {
+    bool ok = true, compiled = true;
+
+    for(int e = 0; e < sizeof(forth_jitEntry)/sizeof(*forth_jitEntry); e++) {
+      char *out1, *out2;
+      ForthInstance *fth1 = forth_jitRun(op, forth_jitEntry[e], false, &out1);
+      ForthInstance *fth2 = forth_jitRun(op, forth_jitEntry[e], true, &out2);
+
+      compiled &= fth2->dict.words[fth2->dict.size-1].jit != 0;
+      ok &= forth_jitSame(fth1, fth2) && strcmp(out1, out2) == 0;
+
+      free(out1);
+      free(out2);
+      forth_freeInstance(fth1);
+      forth_freeInstance(fth2);
+    }
+
+    if(!ok) {
+      printf("jit check: opcode %d differs from the interpreter !\n", op);
+      failed++;
+    }
+    else if(!compiled)
+      interpreted++;
+    else if(forth_jitNative(op))
+      native++;
+    else
+      fallback++;
+  }
+
+  printf("jit check: %d opcodes, %d native, %d through forth_runOp, "
+      "%d in interpreted words, %d failed\n",
+      FORTH_NUM_OPS, native, fallback, interpreted, failed);
+  return failed;
+}
+
+#else
+
+int forth_jitCheck() {
+  printf("jit check: no native code generator for this platform\n");
+  return 0;
+}
+
+#endif
@@ -0,0 +1,347 @@
+/* sforth - tdwsl 2022 */
+
+/* profiling. While fth->profiling is set forth_runWord hands every word
+ * to forth_runProfiled, a build of the checked engine that calls in here
+ * on every opcode and every call and return, and which never runs native
+ * code, so the counts cover everything. The other engines are untouched,
+ * with profiling off the only cost is the flag test in forth_runWord.
+ *
+ * Time is taken at each call and return, along with the hardware counters
+ * when PROFILE-COUNTERS could open them. A word's exclusive counts leave
+ * out the words it calls, its inclusive counts are only added when its
+ * outermost activation returns so that recursion is not counted twice.
+ * The counters are read with one syscall per call and return, so the
+ * profiler's own work ends up in them too, evenly spread per call */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "forth.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/* what is sampled at every call and return */
+enum {
+  FORTH_NS,
+  FORTH_CYCLES,
+  FORTH_INSTRUCTIONS,
+  FORTH_BRANCH_MISSES,
+  FORTH_CACHE_MISSES,
+  FORTH_NUM_COUNTS,
+};
+
+static const char *forth_countNames[] = {
+  "ns", "cycles", "instructions", "branch-misses", "cache-misses",
+};
+
+typedef struct forthProfileWord {
+  long calls;
+  long inclusive[FORTH_NUM_COUNTS], exclusive[FORTH_NUM_COUNTS];
+  /* activations of the word in progress */
+  int active;
+  /* executions of each cell of the program they were counted for */
+  int *program;
+  long *hits;
+} ForthProfileWord;
+
+/* a call in progress, child is what the words it called took */
+typedef struct forthProfileFrame {
+  int word;
+  long start[FORTH_NUM_COUNTS], child[FORTH_NUM_COUNTS];
+} ForthProfileFrame;
+
+typedef struct forthProfile {
+  ForthProfileWord *words;
+  int num_words;
+  ForthProfileFrame *frames;
+  int depth, max_depth;
+  /* opcodes run, and how often each followed each other */
+  int last;
+  long ops[FORTH_NUM_OPS];
+  long pairs[FORTH_NUM_OPS][FORTH_NUM_OPS];
+  /* perf events of the hardware counters, the first leads the group and
+   * is -1 when timing only, and the count each one goes to */
+  int num_counters;
+  int perf[FORTH_NUM_COUNTS];
+  int counters[FORTH_NUM_COUNTS];
+} ForthProfile;
+
+/* opens what it can of the hardware counters as one group on the calling
+ * thread, leaving p->perf[0] -1 if not even cycles can be counted */
+static void forth_openCounters(ForthProfile *p) {
+  p->perf[0] = -1;
+  p->num_counters = 0;
+#ifdef __linux__
+  static const long config[FORTH_NUM_COUNTS] = {
+    [FORTH_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [FORTH_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [FORTH_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+    [FORTH_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+  };
+  for(int i = FORTH_CYCLES; i < FORTH_NUM_COUNTS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config[i];
+    attr.disabled = !p->num_counters;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, p->perf[0], 0);
+    if(fd == -1) {
+      if(!p->num_counters)
+        return;
+      continue;
+    }
+    p->perf[p->num_counters] = fd;
+    p->counters[p->num_counters++] = i;
+  }
+  ioctl(p->perf[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+static void forth_closeCounters(ForthProfile *p) {
+#ifdef __linux__
+  for(int i = 0; i < p->num_counters; i++)
+    close(p->perf[i]);
+#endif
+  p->perf[0] = -1;
+  p->num_counters = 0;
+}
+
+static void forth_sample(ForthProfile *p, long *v) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  v[FORTH_NS] = t.tv_sec * 1000000000L + t.tv_nsec;
+#ifdef __linux__
+  if(p->num_counters) {
+    unsigned long buf[1 + FORTH_NUM_COUNTS];
+    if(read(p->perf[0], buf, sizeof(buf)) > 0)
+      for(int i = 0; i < p->num_counters; i++)
+        v[p->counters[i]] = buf[1+i];
+  }
+#endif
+}
+
+/* the engine is handed copies of dictionary words at the top level, those
+ * are matched by their program */
+static int forth_profileIndex(ForthInstance *fth, ForthWord *w) {
+  if(w >= fth->dict.words && w < fth->dict.words + fth->dict.size)
+    return w - fth->dict.words;
+  for(int i = fth->dict.size-1; i >= 0; i--)
+    if(fth->dict.words[i].program == w->program)
+      return i;
+  return -1;
+}
+
+void forth_setProfile(ForthInstance *fth, bool on, bool counters) {
+  if(on) {
+    forth_freeProfile(fth);
+    ForthProfile *p = calloc(1, sizeof(ForthProfile));
+    p->last = -1;
+    p->perf[0] = -1;
+    if(counters) {
+      forth_openCounters(p);
+      if(!p->num_counters)
+        forth_printf(fth, "no hardware counters, timing only\n");
+    }
+    fth->profile = p;
+  }
+  fth->profiling = on && fth->profile;
+}
+
+void forth_freeProfile(ForthInstance *fth) {
+  ForthProfile *p = fth->profile;
+  fth->profiling = false;
+  if(!p)
+    return;
+  forth_closeCounters(p);
+  for(int i = 0; i < p->num_words; i++)
+    free(p->words[i].hits);
+  free(p->words);
+  free(p->frames);
+  free(p);
+  fth->profile = 0;
+}
+
+const long *forth_profileHits(ForthInstance *fth, ForthWord *w) {
+  ForthProfile *p = fth->profile;
+  if(!p)
+    return 0;
+  int i = forth_profileIndex(fth, w);
+  if(i < 0 || i >= p->num_words || p->words[i].program != w->program)
+    return 0;
+  return p->words[i].hits;
+}
+
+/* starts timing a call to w, returns the depth to unwind to once the
+ * engine that made it is done */
+int forth_profileEnter(ForthInstance *fth, ForthWord *w) {
+  ForthProfile *p = fth->profile;
+  int i = forth_profileIndex(fth, w);
+
+  if(i >= p->num_words) {
+    p->words = realloc(p->words, sizeof(ForthProfileWord)*fth->dict.size);
+    memset(p->words + p->num_words, 0,
+        sizeof(ForthProfileWord)*(fth->dict.size - p->num_words));
+    p->num_words = fth->dict.size;
+  }
+  if(i != -1) {
+    ForthProfileWord *pw = &p->words[i];
+    pw->calls++;
+    pw->active++;
+    /* a word re-derived since it was last counted starts over */
+    if(pw->program != w->program) {
+      free(pw->hits);
+      pw->hits = calloc(w->size ? w->size : 1, sizeof(long));
+      pw->program = w->program;
+    }
+  }
+
+  if(p->depth == p->max_depth) {
+    p->max_depth = p->max_depth ? p->max_depth*2 : 64;
+    p->frames = realloc(p->frames, sizeof(ForthProfileFrame)*p->max_depth);
+  }
+  ForthProfileFrame *f = &p->frames[p->depth++];
+  f->word = i;
+  memset(f->child, 0, sizeof(f->child));
+  forth_sample(p, f->start);
+  return p->depth-1;
+}
+
+void forth_profileLeave(ForthInstance *fth) {
+  ForthProfile *p = fth->profile;
+  ForthProfileFrame *f = &p->frames[--p->depth];
+  /* a counter that fails to read counts nothing for the call */
+  long now[FORTH_NUM_COUNTS];
+  memcpy(now, f->start, sizeof(now));
+  forth_sample(p, now);
+  ForthProfileWord *pw = f->word != -1 ? &p->words[f->word] : 0;
+  bool outermost = pw && --pw->active == 0;
+
+  for(int i = 0; i < FORTH_NUM_COUNTS; i++) {
+    long elapsed = now[i] - f->start[i];
+    if(pw)
+      pw->exclusive[i] += elapsed - f->child[i];
+    if(outermost)
+      pw->inclusive[i] += elapsed;
+    if(p->depth)
+      p->frames[p->depth-1].child[i] += elapsed;
+  }
+}
+
+void forth_profileUnwind(ForthInstance *fth, int depth) {
+  while(fth->profile->depth > depth)
+    forth_profileLeave(fth);
+}
+
+void forth_profileOp(ForthInstance *fth, int op, int pc) {
+  ForthProfile *p = fth->profile;
+  int i = p->frames[p->depth-1].word;
+  if(i != -1)
+    p->words[i].hits[pc]++;
+  p->ops[op]++;
+  if(p->last != -1)
+    p->pairs[p->last][op]++;
+  p->last = op;
+}
+
+typedef struct forthCount {
+  int index;
+  long count;
+} ForthCount;
+
+/* largest count first */
+static int forth_compareCounts(const void *a, const void *b) {
+  long x = ((const ForthCount*)a)->count, y = ((const ForthCount*)b)->count;
+  return (x < y) - (x > y);
+}
+
+/* the nonzero counts among n, sorted, and how many there are */
+static int forth_sortCounts(const long *counts, int n, ForthCount *sorted) {
+  int num = 0;
+  for(int i = 0; i < n; i++)
+    if(counts[i]) {
+      sorted[num].index = i;
+      sorted[num++].count = counts[i];
+    }
+  qsort(sorted, num, sizeof(ForthCount), forth_compareCounts);
+  return num;
+}
+
+#define FORTH_PROFILE_TOP 10
+
+void forth_profileReport(ForthInstance *fth) {
+  ForthProfile *p = fth->profile;
+  if(!p) {
+    forth_printf(fth, "nothing profiled, use PROFILE-ON !\n");
+    return;
+  }
+
+  long total = 0;
+  for(int i = 0; i < FORTH_NUM_OPS; i++)
+    total += p->ops[i];
+  forth_printf(fth, "%ld opcodes run\n", total);
+
+  /* every word called, by exclusive time */
+  int num = 0, pairs = FORTH_NUM_OPS*FORTH_NUM_OPS;
+  ForthCount *sorted = malloc(sizeof(ForthCount)
+      * (p->num_words > pairs ? p->num_words : pairs));
+  for(int i = 0; i < p->num_words; i++)
+    if(p->words[i].calls) {
+      sorted[num].index = i;
+      sorted[num++].count = p->words[i].exclusive[FORTH_NS];
+    }
+  qsort(sorted, num, sizeof(ForthCount), forth_compareCounts);
+  forth_printf(fth, "%-16s %12s %12s %12s\n",
+      "word", "calls", "incl ms", "excl ms");
+  for(int j = 0; j < num; j++) {
+    ForthProfileWord *pw = &p->words[sorted[j].index];
+    forth_printf(fth, "%-16s %12ld %12.3f %12.3f\n",
+        fth->dict.words[sorted[j].index].identifier, pw->calls,
+        pw->inclusive[FORTH_NS] / 1e6, pw->exclusive[FORTH_NS] / 1e6);
+  }
+
+  /* the same words again with what they counted themselves */
+  if(p->num_counters) {
+    forth_printf(fth, "%-16s", "word");
+    for(int i = 0; i < p->num_counters; i++)
+      forth_printf(fth, " %14s", forth_countNames[p->counters[i]]);
+    forth_printf(fth, " %6s\n", "ipc");
+    for(int j = 0; j < num; j++) {
+      ForthProfileWord *pw = &p->words[sorted[j].index];
+      forth_printf(fth, "%-16s", fth->dict.words[sorted[j].index].identifier);
+      for(int i = 0; i < p->num_counters; i++)
+        forth_printf(fth, " %14ld", pw->exclusive[p->counters[i]]);
+      long cycles = pw->exclusive[FORTH_CYCLES];
+      forth_printf(fth, " %6.2f\n",
+          cycles ? (double)pw->exclusive[FORTH_INSTRUCTIONS] / cycles : 0.0);
+    }
+  }
+
+  num = forth_sortCounts(p->ops, FORTH_NUM_OPS, sorted);
+  forth_printf(fth, "%-16s %12s\n", "opcode", "count");
+  for(int j = 0; j < num && j < FORTH_PROFILE_TOP; j++)
+    forth_printf(fth, "%-16s %12ld %5.1f%%\n",
+        forth_opName(sorted[j].index), sorted[j].count,
+        100.0 * sorted[j].count / total);
+
+  num = forth_sortCounts(&p->pairs[0][0], pairs, sorted);
+  forth_printf(fth, "%-16s %12s\n", "opcode pair", "count");
+  for(int j = 0; j < num && j < FORTH_PROFILE_TOP; j++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s %s",
+        forth_opName(sorted[j].index / FORTH_NUM_OPS),
+        forth_opName(sorted[j].index % FORTH_NUM_OPS));
+    forth_printf(fth, "%-16s %12ld\n", name, sorted[j].count);
+  }
+  free(sorted);
+}
@@ -0,0 +1,214 @@
+/* sforth - tdwsl 2022 */
+
+/* the part of the interpreter that programs written by --emit-c still
+ * need, the instance state, its checked stack operations and its output
+ * buffer. Included by forth.h so that the engine and generated code can
+ * both inline them */
+
+#ifndef FORTH_RUNTIME_H
+#define FORTH_RUNTIME_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the engine pops in almost every op and grows past the size gcc will
+ * inline into on its own, so forth_pop is forced */
+#ifdef __GNUC__
+#define FORTH_ALWAYS_INLINE __attribute__((always_inline))
+#else
+#define FORTH_ALWAYS_INLINE
+#endif
+
+static inline void forth_stdoutSink(void *data, const char *s, int n) {
+  fwrite(s, 1, n, stdout);
+}
+
+static inline void forth_initRuntime(ForthInstance *fth) {
+  fth->sp = 0;
+  fth->lsp = 0;
+  fth->rsp = 0;
+  fth->quit = false;
+  fth->here = 0;
+  fth->out.size = 0;
+  fth->out.sink = forth_stdoutSink;
+  fth->out.data = 0;
+}
+
+/* allocates an instance with its stacks and output buffer at sizes,
+ * where 0 or a field of 0 is the default, and records the data space
+ * sizes for the caller to allocate. 0 if any of it cannot be had */
+static inline ForthInstance *forth_allocRuntime(const ForthSizes *sizes) {
+  ForthSizes s = { FORTH_STACK_SIZE, FORTH_LSTACK_SIZE, FORTH_RSTACK_SIZE,
+    FORTH_OUTPUT_SIZE, FORTH_MEMORY_SIZE, 0,
+    FORTH_TASK_LSTACK_SIZE, FORTH_TASK_RSTACK_SIZE };
+  if(sizes) {
+    if(sizes->stack > 0)
+      s.stack = sizes->stack;
+    if(sizes->lstack > 0)
+      s.lstack = sizes->lstack;
+    if(sizes->rstack > 0)
+      s.rstack = sizes->rstack;
+    if(sizes->output > 0)
+      s.output = sizes->output;
+    if(sizes->memory > 0)
+      s.memory = sizes->memory;
+    if(sizes->max_memory > 0)
+      s.max_memory = sizes->max_memory;
+    if(sizes->task_lstack > 0)
+      s.task_lstack = sizes->task_lstack;
+    if(sizes->task_rstack > 0)
+      s.task_rstack = sizes->task_rstack;
+  }
+  /* room for the longest number forth_putNumber writes in one go */
+  if(s.output < 16)
+    s.output = 16;
+  if(s.memory > FORTH_MAX_MEMORY)
+    s.memory = FORTH_MAX_MEMORY;
+  if(s.max_memory < s.memory)
+    s.max_memory = s.memory;
+  if(s.max_memory > FORTH_MAX_MEMORY)
+    s.max_memory = FORTH_MAX_MEMORY;
+
+  ForthInstance *fth = malloc(sizeof(ForthInstance) + sizeof(int)*s.stack);
+  if(!fth)
+    return 0;
+  fth->lstack = malloc(sizeof(int)*s.lstack);
+  fth->rstack = malloc(sizeof(ForthFrame)*s.rstack);
+  fth->out.buf = malloc(s.output);
+  if(!fth->lstack || !fth->rstack || !fth->out.buf) {
+    free(fth->lstack);
+    free(fth->rstack);
+    free(fth->out.buf);
+    free(fth);
+    return 0;
+  }
+
+  fth->stack_size = s.stack;
+  fth->lstack_size = s.lstack;
+  fth->rstack_size = s.rstack;
+  fth->out.cap = s.output;
+  fth->memory_size = s.memory;
+  fth->max_memory = s.max_memory;
+  fth->tasks.lstack_size = s.task_lstack;
+  fth->tasks.rstack_size = s.task_rstack;
+  return fth;
+}
+
+/* frees what forth_allocRuntime allocated, the instance included */
+static inline void forth_freeRuntime(ForthInstance *fth) {
+  free(fth->lstack);
+  free(fth->rstack);
+  free(fth->out.buf);
+  free(fth);
+}
+
+static inline void forth_flushOutput(ForthInstance *fth) {
+  if(fth->out.size)
+    fth->out.sink(fth->out.data, fth->out.buf, fth->out.size);
+  fth->out.size = 0;
+}
+
+static inline void forth_putChar(ForthInstance *fth, char c) {
+  if(fth->out.size == fth->out.cap)
+    forth_flushOutput(fth);
+  fth->out.buf[fth->out.size++] = c;
+}
+
+static inline void forth_putString(ForthInstance *fth, const char *s) {
+  int n = strlen(s);
+  if(fth->out.size + n > fth->out.cap)
+    forth_flushOutput(fth);
+  if(n > fth->out.cap)
+    fth->out.sink(fth->out.data, s, n);
+  else {
+    memcpy(fth->out.buf + fth->out.size, s, n);
+    fth->out.size += n;
+  }
+}
+
+/* n and a space, the way . prints it, without a trip through printf */
+static inline void forth_putNumber(ForthInstance *fth, int n) {
+  char digits[10];
+  int len = 0;
+  unsigned u = n < 0 ? -(unsigned)n : n;
+  do {
+    digits[len++] = '0' + u%10;
+    u /= 10;
+  } while(u);
+
+  if(fth->out.size + 12 > fth->out.cap)
+    forth_flushOutput(fth);
+  char *at = fth->out.buf + fth->out.size;
+  if(n < 0)
+    *at++ = '-';
+  while(len)
+    *at++ = digits[--len];
+  *at++ = ' ';
+  fth->out.size = at - fth->out.buf;
+}
+
+/* data space is addressed in bytes, and @ and ! read and write a whole
+ * cell at any of them */
+static inline int forth_fetch(ForthInstance *fth, int addr) {
+  int n;
+  memcpy(&n, fth->memory + addr, sizeof(int));
+  return n;
+}
+
+static inline void forth_store(ForthInstance *fth, int addr, int n) {
+  memcpy(fth->memory + addr, &n, sizeof(int));
+}
+
+static inline void forth_move(ForthInstance *fth, int from, int to, int n) {
+  if(n > 0)
+    memmove(fth->memory + to, fth->memory + from, n);
+}
+
+/* CMOVE copies a byte at a time from the low end, so copying to a higher
+ * address inside the source repeats its first to-from bytes. Each chunk
+ * of that length starts where the last one was copied from, so none of
+ * them overlap and they can go through memcpy */
+static inline void forth_cmove(ForthInstance *fth, int from, int to, int n) {
+  int d = to - from;
+  if(n <= 0)
+    return;
+  if(d <= 0 || d >= n)
+    memmove(fth->memory + to, fth->memory + from, n);
+  else
+    for(int i = 0; i < n; i += d)
+      memcpy(fth->memory + to + i, fth->memory + from + i,
+          n-i < d ? n-i : d);
+}
+
+static inline void forth_fill(ForthInstance *fth, int addr, int n, int c) {
+  if(n > 0)
+    memset(fth->memory + addr, c, n);
+}
+
+static inline bool forth_has(ForthInstance *fth, int n) {
+  if(fth->sp >= n)
+    return true;
+  else {
+    forth_putString(fth, "stack underflow !\n");
+    return false;
+  }
+}
+
+FORTH_ALWAYS_INLINE static inline int forth_pop(ForthInstance *fth) {
+  if(forth_has(fth, 1))
+    return fth->stack[--(fth->sp)];
+  else
+    return 0;
+}
+
+static inline void forth_push(ForthInstance *fth, int n) {
+  if(fth->sp >= fth->stack_size)
+    forth_putString(fth, "stack overflow !\n");
+  else
+    fth->stack[fth->sp++] = n;
+}
+
+#include "array.h"
+
+#endif
@@ -0,0 +1,213 @@
+/* sforth - tdwsl 2022 */
+
+/* cooperative tasks. TASK makes a task to run a word, START gives it a
+ * cell to start with and makes it runnable, and from then on it runs a
+ * turn whenever the interpreter's own code calls PAUSE, which hands every
+ * started task a turn in order. A task's turn lasts until it calls PAUSE
+ * itself, and it ends when its word returns or something STOPs it. The
+ * interpreter also pauses once after every word it runs at top level, so
+ * tasks go on between lines, and one that never ends can still be
+ * STOPped from the prompt.
+ *
+ * Tasks share the dictionary and data space. Each has loop and return
+ * stacks of its own, sized by ForthSizes, that fth->lstack and
+ * fth->rstack point to while it runs, so a task costs about a kilobyte
+ * at the default sizes. The data stack stays where the
+ * engines expect it, at the end of the instance, and switching copies
+ * what is on it out and the next task's in.
+ *
+ * A task runs in the checked engine, started on its word and resumed
+ * from the frame PAUSE left on its return stack. PAUSE and STOP switch
+ * stacks under whatever runs them, so forth_verifyWord never proves a
+ * word that uses them safe, and the unchecked engine and native code
+ * never meet one */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "forth.h"
+
+static void forth_saveTask(ForthInstance *fth, ForthTask *t) {
+  if(fth->sp > t->stack_cap) {
+    t->stack_cap = fth->sp;
+    t->stack = realloc(t->stack, sizeof(int)*t->stack_cap);
+  }
+  if(fth->sp)
+    memcpy(t->stack, fth->stack, sizeof(int)*fth->sp);
+  t->sp = fth->sp;
+  t->lsp = fth->lsp;
+  t->rsp = fth->rsp;
+  t->lstack = fth->lstack;
+  t->rstack = fth->rstack;
+  t->lstack_size = fth->lstack_size;
+  t->rstack_size = fth->rstack_size;
+}
+
+static void forth_loadTask(ForthInstance *fth, ForthTask *t) {
+  if(t->sp)
+    memcpy(fth->stack, t->stack, sizeof(int)*t->sp);
+  fth->sp = t->sp;
+  fth->lsp = t->lsp;
+  fth->rsp = t->rsp;
+  fth->lstack = t->lstack;
+  fth->rstack = t->rstack;
+  fth->lstack_size = t->lstack_size;
+  fth->rstack_size = t->rstack_size;
+}
+
+static void forth_endTask(ForthInstance *fth, ForthTask *t) {
+  if(t->started)
+    fth->tasks.started--;
+  t->started = false;
+  t->word = -1;
+}
+
+/* the task numbered id, 0 if there is none */
+static ForthTask *forth_getTask(ForthInstance *fth, int id) {
+  if(id < 1 || id > fth->tasks.size || fth->tasks.list[id-1]->word == -1) {
+    forth_putString(fth, "no such task !\n");
+    return 0;
+  }
+  return fth->tasks.list[id-1];
+}
+
+static ForthTask *forth_allocTask(ForthInstance *fth) {
+  ForthTask *t = malloc(sizeof(ForthTask));
+  if(!t)
+    return 0;
+  t->stack = 0;
+  t->stack_cap = 0;
+  t->lstack = malloc(sizeof(int)*fth->tasks.lstack_size);
+  t->rstack = malloc(sizeof(ForthFrame)*fth->tasks.rstack_size);
+  t->lstack_size = fth->tasks.lstack_size;
+  t->rstack_size = fth->tasks.rstack_size;
+  if(!t->lstack || !t->rstack) {
+    free(t->lstack);
+    free(t->rstack);
+    free(t);
+    return 0;
+  }
+  return t;
+}
+
+/* TASK, a task to run the word at index, in the slot of one that ended
+ * if there is one. Returns its number, 0 if it cannot be made */
+int forth_newTask(ForthInstance *fth, int word) {
+  if(word < 0 || word >= fth->dict.size) {
+    forth_putString(fth, "no such word !\n");
+    return 0;
+  }
+
+  int i = 0;
+  while(i < fth->tasks.size && fth->tasks.list[i]->word != -1)
+    i++;
+  if(i == fth->tasks.cap) {
+    int cap = fth->tasks.cap ? fth->tasks.cap*2 : 16;
+    ForthTask **list = realloc(fth->tasks.list, sizeof(ForthTask*)*cap);
+    if(!list) {
+      forth_putString(fth, "out of memory for tasks !\n");
+      return 0;
+    }
+    fth->tasks.list = list;
+    fth->tasks.cap = cap;
+  }
+  if(i == fth->tasks.size) {
+    ForthTask *t = forth_allocTask(fth);
+    if(!t) {
+      forth_putString(fth, "out of memory for tasks !\n");
+      return 0;
+    }
+    fth->tasks.list[fth->tasks.size++] = t;
+  }
+
+  ForthTask *t = fth->tasks.list[i];
+  t->word = word;
+  t->started = false;
+  return i+1;
+}
+
+/* START, with n on its data stack */
+void forth_startTask(ForthInstance *fth, int id, int n) {
+  ForthTask *t = forth_getTask(fth, id);
+  if(!t)
+    return;
+  if(t->started) {
+    forth_putString(fth, "task already started !\n");
+    return;
+  }
+
+  if(!t->stack_cap) {
+    t->stack_cap = 1;
+    t->stack = malloc(sizeof(int));
+  }
+  t->stack[0] = n;
+  t->sp = 1;
+  t->lsp = 0;
+  t->rsp = 0;
+  t->started = true;
+  fth->tasks.started++;
+}
+
+/* STOP, true when that was the task running, whose engine then has to
+ * leave it */
+bool forth_stopTask(ForthInstance *fth, int id) {
+  ForthTask *t = forth_getTask(fth, id);
+  if(!t)
+    return false;
+  forth_endTask(fth, t);
+  return t == fth->task;
+}
+
+/* PAUSE from the interpreter's own code, a turn for each started task */
+void forth_pause(ForthInstance *fth) {
+  if(!fth->tasks.started)
+    return;
+
+  forth_saveTask(fth, &fth->tasks.main);
+  for(int i = 0; i < fth->tasks.size && !fth->quit; i++) {
+    ForthTask *t = fth->tasks.list[i];
+    if(!t->started)
+      continue;
+
+    forth_loadTask(fth, t);
+    fth->task = t;
+    forth_runTask(fth, fth->rsp ? 0 : &fth->dict.words[t->word]);
+    fth->task = 0;
+
+    /* only PAUSE leaves anything on the return stack */
+    if(t->started && fth->rsp && !fth->quit)
+      forth_saveTask(fth, t);
+    else
+      forth_endTask(fth, t);
+  }
+  if(fth->quit)
+    for(int i = 0; i < fth->tasks.size; i++)
+      forth_endTask(fth, fth->tasks.list[i]);
+  forth_loadTask(fth, &fth->tasks.main);
+}
+
+/* turns until every task has ended, for callers whose tasks are known to
+ * end, the interpreter itself only ever pauses */
+void forth_runTasks(ForthInstance *fth) {
+  while(fth->tasks.started && !fth->quit)
+    forth_pause(fth);
+}
+
+void forth_freeTasks(ForthInstance *fth) {
+  for(int i = 0; i < fth->tasks.size; i++) {
+    ForthTask *t = fth->tasks.list[i];
+    free(t->stack);
+    free(t->lstack);
+    free(t->rstack);
+    free(t);
+  }
+  free(fth->tasks.list);
+  free(fth->tasks.main.stack);
+  fth->tasks.list = 0;
+  fth->tasks.size = 0;
+  fth->tasks.cap = 0;
+  fth->tasks.started = 0;
+  fth->tasks.main.stack = 0;
+  fth->tasks.main.stack_cap = 0;
+}